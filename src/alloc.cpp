@@ -0,0 +1,102 @@
+#include "alloc.h"
+
+#include <cstdlib>
+#include <cerrno>
+#include <new>
+
+alloc_stats_t alloc_search;
+
+#ifdef TRACK_ALLOCS
+
+namespace {
+
+thread_local alloc_stats_t thread_allocs;
+
+inline void count_alloc(std::size_t size) {
+    ++thread_allocs.count;
+    thread_allocs.bytes += size;
+}
+
+#ifdef __GLIBC__
+// malloc itself is counted (see below), operator new goes through it
+inline void count_new(std::size_t) {}
+#else
+inline void count_new(std::size_t size) { count_alloc(size); }
+#endif
+
+inline void *counted_malloc(std::size_t size) {
+    count_new(size);
+    // operator new must return a unique pointer even for zero bytes
+    void *ptr = std::malloc(size ? size : 1);
+    if (ptr == nullptr) {
+        std::abort(); // exceptions are disabled
+    }
+    return ptr;
+}
+
+} // namespace
+
+#ifdef __GLIBC__
+// With glibc, the C allocation functions are interposed as well, forwarding to
+// the implementations glibc exports for this purpose. This also counts what
+// the C and C++ libraries allocate internally.
+extern "C" {
+
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t n, std::size_t size);
+void *__libc_realloc(void *ptr, std::size_t size);
+void *__libc_memalign(std::size_t alignment, std::size_t size);
+
+void *malloc(std::size_t size) noexcept {
+    count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(std::size_t n, std::size_t size) noexcept {
+    count_alloc(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, std::size_t size) noexcept {
+    count_alloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+void *aligned_alloc(std::size_t alignment, std::size_t size) noexcept {
+    count_alloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, std::size_t alignment, std::size_t size) noexcept {
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1))) {
+        return EINVAL;
+    }
+    count_alloc(size);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr == nullptr && size ? ENOMEM : 0;
+}
+
+} // extern "C"
+#endif // __GLIBC__
+
+void *operator new(std::size_t size) { return counted_malloc(size); }
+void *operator new[](std::size_t size) { return counted_malloc(size); }
+void *operator new(std::size_t size, const std::nothrow_t&) noexcept { return counted_malloc(size); }
+void *operator new[](std::size_t size, const std::nothrow_t&) noexcept { return counted_malloc(size); }
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+alloc_stats_t alloc_stats() {
+    return thread_allocs;
+}
+
+#else
+
+alloc_stats_t alloc_stats() {
+    return {};
+}
+
+#endif // TRACK_ALLOCS
@@ -0,0 +1,38 @@
+#ifndef ALLOC_H_
+#define ALLOC_H_
+
+#include "types.h"
+
+/* Heap allocation tracking
+ *
+ * Built with TRACK_ALLOCS (make allocs=yes), the global operator new is
+ * replaced by a version counting the allocations of each thread. With glibc,
+ * malloc, calloc, realloc, aligned_alloc and posix_memalign are interposed
+ * too, which also counts the allocations made inside the C and C++ libraries;
+ * elsewhere only operator new is counted. The search
+ * is meant to run without touching the heap, which bench verifies in such
+ * builds. Without TRACK_ALLOCS, all counts stay zero.
+ */
+
+#ifdef TRACK_ALLOCS
+constexpr bool alloc_tracking = true;
+#else
+constexpr bool alloc_tracking = false;
+#endif
+
+typedef struct alloc_stats_t {
+    uint64_t count = 0ULL;
+    uint64_t bytes = 0ULL;
+
+    inline alloc_stats_t operator-(const alloc_stats_t& other) const {
+        return { count - other.count, bytes - other.bytes };
+    }
+} alloc_stats_t;
+
+// Allocations made by the calling thread so far
+alloc_stats_t alloc_stats();
+
+// Allocations made during the last completed search, written by the search thread
+extern alloc_stats_t alloc_search;
+
+#endif // ALLOC_H_
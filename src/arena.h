@@ -1,11 +1,16 @@
 #include <stdlib.h>
 #include <memory>
 #include <cstddef>
+#include <iostream>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 class Arena {
 public:
     explicit Arena(size_t reserved_MB)
-    : m_bytes(static_cast<char*>(malloc(reserved_MB << 20))),
+    : m_bytes(map(reserved_MB << 20)),
       m_size(0),
       m_capacity(reserved_MB << 20) {
           if (m_bytes == nullptr) {
@@ -15,7 +20,29 @@ public:
       }
 
     ~Arena() {
-        free(m_bytes);
+        unmap(m_bytes, m_capacity);
+    }
+
+    /**
+     * @brief Replaces the memory of the arena (dropping its contents)
+     * @param reserved_MB new size of the arena
+     * @return false if the memory couldn't be allocated, in which case the
+     * arena keeps its old memory
+     */
+    bool resize(size_t reserved_MB) {
+        char *bytes = map(reserved_MB << 20);
+        if (bytes == nullptr) {
+            return false;
+        }
+        unmap(m_bytes, m_capacity);
+        m_bytes = bytes;
+        m_size = 0;
+        m_capacity = reserved_MB << 20;
+        return true;
+    }
+
+    size_t capacity() const {
+        return m_capacity;
     }
 
     Arena(const Arena&) = delete;
@@ -70,6 +97,32 @@ public:
     }
 
 private:
+    // Pages are only committed once touched, so a large arena costs nothing
+    // until the tree grows into it (on the NUMA node of the search thread).
+    // We ask for transparent huge pages to cut down on TLB misses.
+    static char *map(size_t bytes) {
+#ifndef _WIN32
+        void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+        return static_cast<char*>(p);
+#else
+        return static_cast<char*>(malloc(bytes));
+#endif
+    }
+
+    static void unmap(char *p, [[maybe_unused]] size_t bytes) {
+#ifndef _WIN32
+        munmap(p, bytes);
+#else
+        free(p);
+#endif
+    }
+
     char *m_bytes;
     size_t m_size;
     size_t m_capacity;
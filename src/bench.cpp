@@ -3,6 +3,125 @@
 #include <string>
 
 #include "time.h"
+#include "perf.h"
+#include "alloc.h"
+#include "movegen.h"
+#include "order.h"
+#include "rng.h"
+#include "mcts.h"
+#include "lanes.h"
+#include "simd.h"
+#include "uci.h"
+
+namespace {
+
+// The move list layout before moves and scores were split, for comparison
+typedef struct scored_move_t {
+    int32_t score;
+    move_t move;
+} scored_move_t;
+
+typedef struct aos_movelist_t {
+    scored_move_t movelist[MAX_MOVES];
+    scored_move_t* last = movelist;
+    size_t used = 0;
+
+    size_t size() const { return static_cast<size_t>(last - movelist); }
+    void assign(const aos_movelist_t& other) {
+        last = std::copy(other.movelist, static_cast<const scored_move_t*>(other.last), movelist);
+        used = 0;
+    }
+    void erase(scored_move_t* position) {
+        std::move(position + 1, last, position);
+        --last;
+    }
+    scored_move_t* find(const move_t target) {
+        for (scored_move_t* it = movelist; it != last; ++it) {
+            if (it->move == target) {
+                return it;
+            }
+        }
+        return nullptr;
+    }
+    move_t next_best() {
+        size_t best_idx = used;
+        int32_t best_score = 0;
+        for (size_t idx = used; idx < size(); ++idx) {
+            if (movelist[idx].score > best_score) {
+                best_score = movelist[idx].score;
+                best_idx = idx;
+            }
+        }
+        std::swap(movelist[used], movelist[best_idx]);
+        return movelist[used++].move;
+    }
+} aos_movelist_t;
+
+// Selecting moves in order of their scores (as in alpha-beta)
+uint64_t pick_all(movelist_t& moves) {
+    uint64_t sum = 0;
+    moves.used = 0;
+    while (moves.used < moves.size()) {
+        moves.swap(moves.used, moves.best(moves.used));
+        sum += moves.moves[moves.used++];
+    }
+    return sum;
+}
+
+uint64_t pick_all(aos_movelist_t& moves) {
+    uint64_t sum = 0;
+    moves.used = 0;
+    while (moves.used < moves.size()) {
+        sum += moves.next_best();
+    }
+    return sum;
+}
+
+// Looking up every move
+uint64_t find_all(const movelist_t& moves, const move_t *order, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += moves.find(order[i]);
+    }
+    return sum;
+}
+
+uint64_t find_all(aos_movelist_t& moves, const move_t *order, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += moves.find(order[i]) - moves.movelist;
+    }
+    return sum;
+}
+
+// Removing moves one by one (as MCTS does with untried moves)
+uint64_t remove_all(const movelist_t& list, const move_t *order, size_t n) {
+    static movelist_t moves;
+    std::copy(list.moves, list.moves + n, moves.moves);
+    std::copy(list.scores, list.scores + n, moves.scores);
+    moves.count = n;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        int idx = moves.find(order[i]);
+        sum += idx;
+        moves.erase(idx);
+    }
+    return sum;
+}
+
+uint64_t remove_all(const aos_movelist_t& list, const move_t *order, size_t n) {
+    static aos_movelist_t moves;
+    moves.assign(list);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        scored_move_t *it = moves.find(order[i]);
+        sum += it - moves.movelist;
+        moves.erase(it);
+    }
+    return sum;
+}
+
+} // namespace
 
 // From Berserk
 static std::string positions[] = {
@@ -58,20 +177,32 @@ static std::string positions[] = {
     "r1bq2k1/p4r1p/1pp2pp1/3p4/1P1B3Q/P2B1N2/2P3PP/4R1K1 b - - 2 19"
 };
 
-void bench(std::thread& search_thread, board_t *board, searchinfo_t *info) {
+void bench(std::thread& search_thread, board_t *board, searchinfo_t *info, bool mcts) {
 
-    // Bench parameters
+    // Bench parameters (MCTS searches each position for a fixed time)
+    constexpr int MCTS_MOVETIME = 100;
     info->clear();
     info->depth = 13;
-    info->time_set = false;
+    info->time_set = mcts;
+    info->use_mcts = mcts;
+    info->multipv = 1;
+    info->searchmoves.clear();
+    info->minimax_weight = find_option("Minimax Weight")->value;
+    info->node_limit = 0;
+    info->gumbel_root = find_option("Gumbel Root")->value;
+    info->lane_playouts = find_option("Lane Playouts")->value;
+    clear_playout_stats();
 
     uint64_t times[50] = {};
     uint64_t nodes[50] = {};
     uint64_t total_nodes = 0ULL;
     uint64_t start = 0ULL, total_time = 1ULL; // handle div-by-zero
+    perf_sample_t total_perf;
+    alloc_stats_t total_allocs;
     for (int i = 0; i < 50; ++i) {
         setup(board, positions[i]);
         info->start = start = now();
+        info->end = start + MCTS_MOVETIME;
         search_start(search_thread, board, info);
         if (search_thread.joinable()) {
             search_thread.join();
@@ -83,9 +214,135 @@ void bench(std::thread& search_thread, board_t *board, searchinfo_t *info) {
         std::cout << positions[i] << " " \
                   << nodes[i]     << " " \
                   << times[i]     << std::endl;
+        total_allocs.count += alloc_search.count;
+        total_allocs.bytes += alloc_search.bytes;
+        if (perf_enabled) {
+            perf_print("position " + std::to_string(i + 1), perf_search);
+            total_perf.add(perf_sample_t(), perf_search);
+        }
     }
     std::cout << std::endl;
     std::cout << total_nodes << " nodes " \
         << int(1000.0 * total_nodes / total_time) << " nps " \
         << total_time << " ms " << std::endl;
+    if (perf_enabled) {
+        perf_print("total", total_perf);
+    }
+    if (mcts) {
+        print_playout_stats();
+    }
+    info->use_mcts = false;
+
+    // The search must not allocate (only verifiable in builds tracking allocations)
+    if (alloc_tracking) {
+        std::cout << total_allocs.count << " allocations " \
+            << total_allocs.bytes << " bytes during search" << std::endl;
+        if (total_allocs.count) {
+            std::cout << "bench FAILED: the search allocated memory" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void bench_movelist(board_t *board) {
+    constexpr int POSITIONS = 50;
+    constexpr int REPEAT = 5'000;
+    constexpr int ROUNDS = 8;
+    static movelist_t soa[POSITIONS];
+    static aos_movelist_t aos[POSITIONS];
+    // Moves are removed in a random order, like MCTS picks untried moves
+    static move_t order[POSITIONS][MAX_MOVES];
+
+    uint64_t total_moves = 0;
+    for (int i = 0; i < POSITIONS; ++i) {
+        setup(board, positions[i]);
+        generate_moves(board, &soa[i]);
+        score_moves(board, &soa[i], NULLMV, nullptr);
+        aos[i].last = aos[i].movelist;
+        for (size_t j = 0; j < soa[i].size(); ++j) {
+            *aos[i].last++ = { soa[i].scores[j], soa[i].moves[j] };
+            order[i][j] = soa[i].moves[j];
+        }
+        for (size_t j = soa[i].size() - 1; j > 0; --j) {
+            std::swap(order[i][j], order[i][rand_uint64() % (j + 1)]);
+        }
+        total_moves += soa[i].size();
+    }
+
+    // Best of several rounds, as timings are noisy
+    auto run = [&](const char *name, auto kernel) {
+        uint64_t checksum = 0, best = UINT64_MAX;
+        for (int round = 0; round < ROUNDS; ++round) {
+            const uint64_t start = now();
+            for (int r = 0; r < REPEAT; ++r) {
+                for (int i = 0; i < POSITIONS; ++i) {
+                    checksum += kernel(i);
+                }
+            }
+            best = MIN(best, MAX(now() - start, 1ULL));
+        }
+        std::cout << name << ": " << best << " ms, "
+                  << 1e6 * best / (REPEAT * total_moves) << " ns/move "
+                  << "(checksum " << checksum << ")" << std::endl;
+    };
+
+    std::cout << total_moves << " moves in " << POSITIONS << " positions, "
+              << REPEAT << " repetitions, best of " << ROUNDS << std::endl;
+    run("pick best (split) ", [&](int i) { return pick_all(soa[i]); });
+    run("pick best (pairs) ", [&](int i) { return pick_all(aos[i]); });
+    run("find (split)      ", [&](int i) { return find_all(soa[i], order[i], soa[i].size()); });
+    run("find (pairs)      ", [&](int i) { return find_all(aos[i], order[i], aos[i].size()); });
+    run("find+erase (split)", [&](int i) { return remove_all(soa[i], order[i], soa[i].size()); });
+    run("find+erase (pairs)", [&](int i) { return remove_all(aos[i], order[i], aos[i].size()); });
+}
+
+void bench_playouts(board_t *board, searchinfo_t *info) {
+    constexpr int POSITIONS = 50;
+    constexpr int PLAYOUTS = 2'000;
+    constexpr int ROUNDS = 3;
+    // Playouts as long as the shortest scalar ones (see PLAYOUT_PLIES)
+    constexpr int PLIES = 4;
+
+    // simulate() gives up unless a search is going on
+    const int state = info->state;
+    info->clear();
+    info->state = ENGINE_SEARCHING;
+    info->time_set = false;
+    info->node_limit = 0;
+    info->lane_playouts = false;
+    clear_playout_policy();
+
+    // Best of several rounds, as timings are noisy
+    auto run = [&](const char *name, int lanes, auto kernel) {
+        double sum = 0.0;
+        uint64_t best = UINT64_MAX;
+        for (int round = 0; round < ROUNDS; ++round) {
+            const uint64_t start = now();
+            for (int i = 0; i < POSITIONS; ++i) {
+                setup(board, positions[i]);
+                for (int p = 0; p < PLAYOUTS; p += lanes) {
+                    sum += kernel() * lanes;
+                }
+            }
+            best = MIN(best, MAX(now() - start, 1ULL));
+        }
+        std::cout << name << ": " << best << " ms, "
+                  << static_cast<uint64_t>(1000.0 * POSITIONS * PLAYOUTS / best) << " playouts/s, "
+                  << "average reward " << sum / (ROUNDS * POSITIONS * PLAYOUTS) << std::endl;
+    };
+
+    std::cout << PLAYOUTS << " playouts from each of " << POSITIONS << " positions, best of "
+              << ROUNDS << std::endl;
+    run("simulate ", 1, [&] {
+        const int root_ply = board->history_ply;
+        const double reward = simulate(board, info);
+        while (board->history_ply > root_ply) {
+            undo_move(board);
+        }
+        return reward;
+    });
+    const std::string lanes = "lanes (x" + std::to_string(VEC_LANES) + ")";
+    run(lanes.c_str(), VEC_LANES, [&] { return lane_playouts(board, PLIES); });
+
+    info->state = state;
 }
@@ -5,6 +5,24 @@
 #include "board.h"
 #include "threads.h"
 
-void bench(std::thread &search_thread, board_t *board, searchinfo_t *info);
+/**
+ * @brief Searches a fixed set of positions and reports the nodes searched
+ * and the speed of the search
+ * @param mcts benchmark MCTS instead of alpha-beta
+ */
+void bench(std::thread &search_thread, board_t *board, searchinfo_t *info, bool mcts = false);
+
+/**
+ * @brief Times the move list kernels (picking the best scored move, finding
+ * and removing moves) on the moves of the bench positions, against the
+ * previous array-of-structs layout
+ */
+void bench_movelist(board_t *board);
+
+/**
+ * @brief Times MCTS playouts from the bench positions: the scalar simulate()
+ * against the experimental lane playouts (see lanes.h)
+ */
+void bench_playouts(board_t *board, searchinfo_t *info);
 
 #endif // BENCH_H_
@@ -33,6 +33,11 @@ uint64_t turn_key = 0ULL;
 uint64_t castle_keys[16] = {}; // == WK | WQ | BK | BQ + 1 = 0b1111 + 1
 uint64_t *ep_keys;
 
+// Repetition filter bucket of a key
+inline uint8_t& key_filter(board_t *board, const uint64_t key) {
+    return board->key_filter[key & (REPETITION_FILTER_SIZE - 1)];
+}
+
 void init_keys() {
     seed_rng();
     // For each piece type and square generate a random key
@@ -68,6 +73,9 @@ void reset(board_t *board) {
         };
     }
 
+    // Clear the repetition filter
+    memset(board->key_filter, 0, sizeof(board->key_filter));
+
     // Reset the 8x8 board
     memset(board->pieces, 0, sizeof(board->pieces));
 
@@ -328,6 +336,10 @@ uint64_t generate_pos_key(const board_t *board) {
 
 
 bool is_repetition(const board_t *board) {
+    // Most positions have no earlier occurrence of their key at all
+    if (board->key_filter[board->key & (REPETITION_FILTER_SIZE - 1)] == 0) {
+        return false;
+    }
     // We'll search the history backwards starting from last possible
     // repetition, which is 2 halfmoves ago
     int i = 2;
@@ -342,6 +354,92 @@ bool is_repetition(const board_t *board) {
     return false;
 }
 
+/********************************/
+/* Upcoming repetition (cuckoo) */
+/********************************/
+
+// see: https://www.chessprogramming.org/Repetitions#Cuckoo_Tables
+
+// Keys (piece keys of both squares and the side to move) of all reversible
+// moves on an empty board and the moves themselves, stored in a cuckoo hash
+// table with the hash functions cuckoo_h1 and cuckoo_h2
+uint64_t cuckoo_keys[8192] = {};
+move_t cuckoo_moves[8192] = {};
+
+inline int cuckoo_h1(const uint64_t key) { return key & 0x1fff; }
+inline int cuckoo_h2(const uint64_t key) { return (key >> 16) & 0x1fff; }
+
+void init_cuckoo() {
+    constexpr piece_t movers[] = { N, B, R, Q, K, n, b, r, q, k };
+    [[maybe_unused]] int count = 0;
+    for (piece_t pc : movers) {
+        for (square_t s1 = A1; s1 <= H8; ++s1) {
+            const bb_t targets = piece_type(pc) == KING ? attacks<KING>(s1) : attacks(pc, s1, 0ULL);
+            for (square_t s2 = s1 + 1; s2 <= H8; ++s2) {
+                if (!(targets & SQ_TO_BB(s2))) {
+                    continue;
+                }
+                move_t move = Move(s1, s2, QUIET);
+                uint64_t key = piece_keys[pc][s1] ^ piece_keys[pc][s2] ^ turn_key;
+                // Insert, kicking out the entries in the way to their other slot
+                int i = cuckoo_h1(key);
+                while (true) {
+                    std::swap(cuckoo_keys[i], key);
+                    std::swap(cuckoo_moves[i], move);
+                    if (move == NULLMV) {
+                        break;
+                    }
+                    i = (i == cuckoo_h1(key)) ? cuckoo_h2(key) : cuckoo_h1(key);
+                }
+                ++count;
+            }
+        }
+    }
+    assert(count == 3668);
+}
+
+// Squares strictly between s1 and s2 (empty if they are not on a line)
+inline bb_t between(const square_t s1, const square_t s2) {
+    if (attacks<ROOK>(s1, 0ULL) & SQ_TO_BB(s2)) {
+        return attacks<ROOK>(s1, SQ_TO_BB(s2)) & attacks<ROOK>(s2, SQ_TO_BB(s1));
+    }
+    if (attacks<BISHOP>(s1, 0ULL) & SQ_TO_BB(s2)) {
+        return attacks<BISHOP>(s1, SQ_TO_BB(s2)) & attacks<BISHOP>(s2, SQ_TO_BB(s1));
+    }
+    return 0ULL;
+}
+
+bool has_game_cycle(const board_t *board) {
+    // Only positions after the root count (so that a draw is never claimed
+    // for a line that merely passes through the game history once more),
+    // and none before the last irreversible move
+    const int end = MIN(board->fifty_move, board->ply - 1);
+    for (int i = 1; i <= end; ++i) {
+        const undo_t& prev = board->history[board->history_ply - i];
+        // A null move breaks the sequence of reversible moves
+        if (prev.move == NULLMV) {
+            return false;
+        }
+        // The opponent's positions differ by a move of the side to move
+        if (i < 3 || i % 2 == 0) {
+            continue;
+        }
+        const uint64_t move_key = board->key ^ prev.key;
+        int j = cuckoo_h1(move_key);
+        if (cuckoo_keys[j] != move_key) {
+            j = cuckoo_h2(move_key);
+            if (cuckoo_keys[j] != move_key) {
+                continue;
+            }
+        }
+        const move_t move = cuckoo_moves[j];
+        if (!(between(get_from(move), get_to(move)) & all_pieces(board))) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void test(board_t *board) {
     setup(board, "1k1r4/1pp4p/p7/4p3/8/P5P1/1PP4P/2K1R3 w - -");
     print(board);
@@ -430,6 +528,7 @@ bool make_move(board_t *board, move_t move) {
         .key = board->key,
         .captured = NO_PIECE
     };
+    ++key_filter(board, board->key);
 
     // Extract move data
     square_t from = get_from(move);
@@ -523,6 +622,7 @@ void undo_move(board_t *board, move_t move) {
     assert(check(board));
 
     undo_t &last = board->history[--board->history_ply];
+    --key_filter(board, last.key);
     board->castle_rights = last.castle_rights;
     board->ep_square = last.ep_square;
     board->fifty_move = last.fifty_move;
@@ -607,6 +707,7 @@ void make_null(board_t *board) {
         .key = board->key,
         .captured = NO_PIECE
     };
+    ++key_filter(board, board->key);
 
     /* Update board state */
 
@@ -634,6 +735,7 @@ void undo_null(board_t *board) {
 #endif
 
     undo_t &last = board->history[--board->history_ply];
+    --key_filter(board, last.key);
 
     board->turn ^= 1;
     board->key ^= turn_key;
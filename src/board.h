@@ -11,6 +11,9 @@
 /* Board representation */
 /************************/
 
+// Number of entries in the repetition filter (a power of 2)
+#define REPETITION_FILTER_SIZE (1024)
+
 // The Board type
 /**
  * @brief The board struct
@@ -40,6 +43,9 @@ typedef struct board_t {
     uint64_t key = 0ULL;
     // History of previous positions
     undo_t history[MAX_MOVES];
+    // Number of keys in the history falling into each bucket (low bits of the
+    // key). An empty bucket rules out a repetition without scanning the history
+    uint8_t key_filter[REPETITION_FILTER_SIZE] = {};
     // Killer moves for move ordering (cause a beta cutoff but aren't captures)
     // move_t killer1[MAX_DEPTH] = {};
     // move_t killer2[MAX_DEPTH] = {};
@@ -71,6 +77,19 @@ extern uint64_t generate_pos_key(const board_t *board);
 
 bool is_repetition(const board_t *board);
 
+// Builds the cuckoo tables used by has_game_cycle() (needs the attack tables)
+extern void init_cuckoo();
+
+/**
+ * @brief Checks if the side to move has a reversible move leading back to a
+ * position seen since the root of the search (an "upcoming repetition"), in
+ * which case it can claim at least a draw. Uses the cuckoo tables of
+ * Marcel van Kervinck, as in Stockfish.
+ * @param board current position
+ * @return True if such a move exists and its path is clear
+ */
+bool has_game_cycle(const board_t *board);
+
 bool make_move(board_t *board, move_t move);
 
 void undo_move(board_t *board, move_t move);
@@ -1,6 +1,7 @@
 /* Evaluation */
 #include "eval.h"
 #include "attack.h"
+#include "simd.h"
 
 /* Piece values */
 
@@ -386,6 +387,104 @@ int king_safety_score(const board_t *board, const int colour, int attackers) {
 }
 
 
+/* Mobility & king attacks
+ *
+ * The attack sets of a side's pieces are collected first and then scored
+ * together: the popcounts (of the attack sets and of their intersection with
+ * the enemy king zone) and the weighted sums are done VEC_LANES pieces at a
+ * time. With SIMD, the attack sets of the sliders are computed in lanes as
+ * well (Kogge-Stone fills of all bishops, rooks and queens on the board at
+ * once) instead of one magic lookup per piece.
+ *
+ * Only used when built with simd=avx2/avx512: the scalar build keeps scoring
+ * each piece as it goes, as that measured faster than collecting the pieces
+ * first. So far the PEXT lookups have also beaten the fills (~1.35x faster
+ * evaluate() than AVX-512 on an AVX-512 capable Xeon), which is why
+ * SIMD isn't the default. */
+
+// A side has at most 15 pieces besides its king, we pad to a multiple of 8
+constexpr int ATTACKERS_NO = 16;
+
+typedef struct attackers_t {
+    alignas(64) bb_t attacks[ATTACKERS_NO];
+    alignas(64) int64_t mobility_weight[ATTACKERS_NO];
+    alignas(64) int64_t king_weight[ATTACKERS_NO];
+    int size = 0;
+
+    inline void push(const bb_t attacks_bb, const piece_t pce) {
+        attacks[size] = attacks_bb;
+        mobility_weight[size] = mobility_weights[pce];
+        king_weight[size] = KING_ATTACK_WEIGHT[pce];
+        ++size;
+    }
+
+    // Fills up the last vector with pieces contributing nothing
+    inline void pad() {
+        for (int i = size; i % VEC_LANES; ++i) {
+            attacks[i] = 0ULL;
+            mobility_weight[i] = king_weight[i] = 0;
+        }
+    }
+} attackers_t;
+
+/**
+ * @brief Scores the mobility of the pieces and their attacks on the enemy king
+ * @param mobility weighted number of attacked squares
+ * @param zone_attacks weighted number of attacks on the enemy king zone
+ */
+inline void score_attacks(attackers_t& att, const bb_t king_zone,
+                          int *mobility, int *zone_attacks) {
+    att.pad();
+    const vec_t zone = vec_set1(king_zone);
+    vec_t mob = vec_set1(0), king = vec_set1(0);
+    for (int i = 0; i < att.size; i += VEC_LANES) {
+        const vec_t a = vec_load(att.attacks + i);
+        // The weights are small, so 32x32 -> 64-bit products suffice
+        mob  = vec_add(mob, vec_mul32(vec_popcnt(a),
+                       vec_load(reinterpret_cast<const uint64_t*>(att.mobility_weight + i))));
+        king = vec_add(king, vec_mul32(vec_popcnt(vec_and(a, zone)),
+                       vec_load(reinterpret_cast<const uint64_t*>(att.king_weight + i))));
+    }
+    *mobility = vec_hsum(mob);
+    *zone_attacks = vec_hsum(king);
+}
+
+inline vec_t orthogonal_attacks(const vec_t gen, const vec_t empty) {
+    const vec_t all = vec_set1(~0ULL), not_a = vec_set1(NOT_AFILE), not_h = vec_set1(NOT_HFILE);
+    return vec_or(vec_or(vec_slide< 8>(gen, empty, all),   vec_slide<-8>(gen, empty, all)),
+                  vec_or(vec_slide< 1>(gen, empty, not_a), vec_slide<-1>(gen, empty, not_h)));
+}
+
+inline vec_t diagonal_attacks(const vec_t gen, const vec_t empty) {
+    const vec_t not_a = vec_set1(NOT_AFILE), not_h = vec_set1(NOT_HFILE);
+    return vec_or(vec_or(vec_slide< 9>(gen, empty, not_a), vec_slide< 7>(gen, empty, not_h)),
+                  vec_or(vec_slide<-7>(gen, empty, not_a), vec_slide<-9>(gen, empty, not_h)));
+}
+
+/**
+ * @brief Attack sets of all the sliders on the board (of both sides)
+ * @param sliders_attacks indexed by square, only slider squares are written
+ */
+template<vec_t (*fill)(const vec_t, const vec_t)>
+inline void batch_slider_attacks(bb_t sliders, const bb_t occupied, bb_t *sliders_attacks) {
+    alignas(64) uint64_t squares[VEC_LANES], result[VEC_LANES];
+    const vec_t empty = vec_set1(~occupied);
+    while (sliders) {
+        int n = 0;
+        for (; n < VEC_LANES && sliders; ++n) {
+            squares[n] = POPLSB(sliders);
+        }
+        // Empty lanes hold no slider (shifting by 64 gives 0)
+        for (int i = n; i < VEC_LANES; ++i) {
+            squares[i] = 64;
+        }
+        vec_store(result, fill(vec_sllv(vec_set1(1), vec_load(squares)), empty));
+        for (int i = 0; i < n; ++i) {
+            sliders_attacks[squares[i]] |= result[i];
+        }
+    }
+}
+
 // Originally from sjeng 11.2 (adapted from Vice 1.1)
 int material_draw(const board_t *board) {
     assert(check(board));
@@ -603,6 +702,21 @@ int evaluate(const board_t *board, eval_t * eval) {
 
     piece_t pce;
     bb_t attacks_bb;
+    int mobility, zone_attacks;
+    attackers_t attackers;
+
+    alignas(64) bb_t sliders_attacks[SQUARE_NO];
+    if constexpr (VEC_LANES > 1) {
+        const bb_t queens = board->bitboards[Q] | board->bitboards[q];
+        const bb_t bishops = board->bitboards[B] | board->bitboards[b] | queens;
+        const bb_t rooks = board->bitboards[R] | board->bitboards[r] | queens;
+        bb_t sliders = bishops | rooks;
+        while (sliders) {
+            sliders_attacks[POPLSB(sliders)] = 0ULL;
+        }
+        batch_slider_attacks<diagonal_attacks>(bishops, occupied, sliders_attacks);
+        batch_slider_attacks<orthogonal_attacks>(rooks, occupied, sliders_attacks);
+    }
     while (bb) {
         sq = POPLSB(bb);
         pce = board->pieces[sq];
@@ -639,13 +753,27 @@ int evaluate(const board_t *board, eval_t * eval) {
         }
 
         // Mobility and attacks on the enemy king
-        attacks_bb = attacks(pce, sq, occupied);
-        sides_attacks[WHITE] |= attacks_bb;
+        if constexpr (VEC_LANES > 1) {
+            // (scored below)
+            attacks_bb = piece_type(pce) == KNIGHT ? attacks(pce, sq, occupied) : sliders_attacks[sq];
+            sides_attacks[WHITE] |= attacks_bb;
+            attackers.push(attacks_bb, pce);
+        } else {
+            attacks_bb = attacks(pce, sq, occupied);
+            sides_attacks[WHITE] |= attacks_bb;
+
+            king_attacks_score[BLACK] +=
+                KING_ATTACK_WEIGHT[pce] * CNT(king_zone & attacks_bb);
+            eval->middlegame += CNT(attacks_bb) * mobility_weights[pce];
+            eval->endgame    += CNT(attacks_bb) * mobility_weights[pce];
+        }
+    }
 
-        king_attacks_score[BLACK] +=
-            KING_ATTACK_WEIGHT[pce] * CNT(king_zone & attacks_bb);
-        eval->middlegame += CNT(attacks_bb) * mobility_weights[pce];
-        eval->endgame    += CNT(attacks_bb) * mobility_weights[pce];
+    if constexpr (VEC_LANES > 1) {
+        score_attacks(attackers, king_zone, &mobility, &zone_attacks);
+        king_attacks_score[BLACK] += zone_attacks;
+        eval->middlegame += mobility;
+        eval->endgame    += mobility;
     }
 
     // Black
@@ -660,6 +788,7 @@ int evaluate(const board_t *board, eval_t * eval) {
     eval->middlegame -= CNT(bb & pawn_protected[BLACK]) * pawn_protected_bonus;
     eval->endgame    -= CNT(bb & pawn_protected[BLACK]) * pawn_protected_bonus;
 
+    attackers.size = 0;
     while (bb) {
         sq = POPLSB(bb);
         pce = board->pieces[sq];
@@ -696,14 +825,27 @@ int evaluate(const board_t *board, eval_t * eval) {
         }
 
         // Mobility and attacks on the enemy king
-        attacks_bb = attacks(pce, sq, occupied);
-        sides_attacks[BLACK] |= attacks_bb;
-
-        king_attacks_score[WHITE] +=
-            KING_ATTACK_WEIGHT[pce] * CNT(king_zone & attacks_bb);
+        if constexpr (VEC_LANES > 1) {
+            // (scored below)
+            attacks_bb = piece_type(pce) == KNIGHT ? attacks(pce, sq, occupied) : sliders_attacks[sq];
+            sides_attacks[BLACK] |= attacks_bb;
+            attackers.push(attacks_bb, pce);
+        } else {
+            attacks_bb = attacks(pce, sq, occupied);
+            sides_attacks[BLACK] |= attacks_bb;
+
+            king_attacks_score[WHITE] +=
+                KING_ATTACK_WEIGHT[pce] * CNT(king_zone & attacks_bb);
+            eval->middlegame -= CNT(attacks_bb) * mobility_weights[pce];
+            eval->endgame    -= CNT(attacks_bb) * mobility_weights[pce];
+        }
+    }
 
-        eval->middlegame -= CNT(attacks_bb) * mobility_weights[pce];
-        eval->endgame    -= CNT(attacks_bb) * mobility_weights[pce];
+    if constexpr (VEC_LANES > 1) {
+        score_attacks(attackers, king_zone, &mobility, &zone_attacks);
+        king_attacks_score[WHITE] += zone_attacks;
+        eval->middlegame -= mobility;
+        eval->endgame    -= mobility;
     }
 
     /* Bishop pair bonus */
@@ -0,0 +1,248 @@
+#include "lanes.h"
+
+#include <algorithm>
+#include <immintrin.h>
+
+#include "simd.h"
+#include "bitboard.h"
+#include "rng.h"
+#include "sgd.h"
+
+namespace {
+
+constexpr bb_t NOT_ABFILE = ~(FILEA_BB | FILEB_BB);
+constexpr bb_t NOT_GHFILE = ~(FILEG_BB | FILEH_BB);
+constexpr bb_t ALL_SQ = ~0ULL;
+
+// Material values (cp) used to score the playouts which run out of plies
+constexpr int PIECE_VALUES[] = { 0, 100, 300, 300, 500, 900, 0 };
+
+// Move sets generated for every lane. Each pseudo-legal move belongs to exactly
+// one set, so it's identified by its set and its destination square
+enum {
+    PUSH, DOUBLE_PUSH, CAPTURE_WEST, CAPTURE_EAST,
+    KNIGHT_SETS = 4, KING_SETS = 12, ORTHOGONAL_SETS = 20, DIAGONAL_SETS = 24,
+    SETS = 28
+};
+
+// Direction of the moves in each set: the origin of a move is its destination
+// minus the shift or, for slider sets, the first piece met stepping back by it
+constexpr int SHIFTS[SETS] = {
+    8, 16, 7, 9,
+    17, 15, 10, 6, -6, -10, -15, -17,
+    9, 8, 7, 1, -1, -7, -8, -9,
+    8, -8, 1, -1,
+    9, 7, -7, -9
+};
+// Black's pawns move the other way
+constexpr int BLACK_PAWN_SHIFTS[KNIGHT_SETS] = { -8, -16, -9, -7 };
+
+typedef struct alignas(64) lanes_t {
+    // Bitboards of each side's pieces by type (NONE is unused), lane by lane
+    uint64_t pieces[BOTH][KING + 1][VEC_LANES];
+    // Lanes whose playout is over, and their rewards for the starting side
+    bool over[VEC_LANES];
+    double reward[VEC_LANES];
+} lanes_t;
+
+// The n-th (from 0) set bit of bb
+inline bb_t nth_bit(bb_t bb, uint64_t n) {
+    #ifdef __BMI2__
+    return _pdep_u64(1ULL << n, bb);
+    #else
+    while (n--) {
+        CLRLSB(bb);
+    }
+    return LSB_BB(bb);
+    #endif
+}
+
+// Destinations of the pieces in gen moving by N which start on from and end
+// on to, in each lane
+template<int N>
+inline vec_t leap(const vec_t gen, const bb_t from, const vec_t to) {
+    return vec_and(vec_shift<N>(vec_and(gen, vec_set1(from))), to);
+}
+
+// Generates the move sets of Me in every lane (see SHIFTS)
+template<int Me>
+void generate(const lanes_t& lanes, uint64_t sets[SETS][VEC_LANES]) {
+    constexpr int Up = Me == WHITE ? 8 : -8;
+    const vec_t all = vec_set1(ALL_SQ);
+    vec_t own = vec_set1(0), opp = vec_set1(0);
+    for (piece_t type = PAWN; type <= KING; ++type) {
+        own = vec_or(own, vec_load(lanes.pieces[Me][type]));
+        opp = vec_or(opp, vec_load(lanes.pieces[Me ^ 1][type]));
+    }
+    const vec_t empty = vec_andnot(vec_or(own, opp), all);
+    const vec_t targets = vec_andnot(own, all);
+
+    const vec_t pawns = vec_load(lanes.pieces[Me][PAWN]);
+    const vec_t push = vec_and(vec_shift<Up>(pawns), empty);
+    const vec_t third_rank = vec_set1(Me == WHITE ? RANK3_BB : RANK6_BB);
+    vec_store(sets[PUSH], push);
+    vec_store(sets[DOUBLE_PUSH], vec_and(vec_shift<Up>(vec_and(push, third_rank)), empty));
+    vec_store(sets[CAPTURE_WEST], leap<Up - 1>(pawns, NOT_AFILE, opp));
+    vec_store(sets[CAPTURE_EAST], leap<Up + 1>(pawns, NOT_HFILE, opp));
+
+    const vec_t knights = vec_load(lanes.pieces[Me][KNIGHT]);
+    vec_store(sets[KNIGHT_SETS + 0], leap< 17>(knights, NOT_HFILE, targets));
+    vec_store(sets[KNIGHT_SETS + 1], leap< 15>(knights, NOT_AFILE, targets));
+    vec_store(sets[KNIGHT_SETS + 2], leap< 10>(knights, NOT_GHFILE, targets));
+    vec_store(sets[KNIGHT_SETS + 3], leap<  6>(knights, NOT_ABFILE, targets));
+    vec_store(sets[KNIGHT_SETS + 4], leap< -6>(knights, NOT_GHFILE, targets));
+    vec_store(sets[KNIGHT_SETS + 5], leap<-10>(knights, NOT_ABFILE, targets));
+    vec_store(sets[KNIGHT_SETS + 6], leap<-15>(knights, NOT_HFILE, targets));
+    vec_store(sets[KNIGHT_SETS + 7], leap<-17>(knights, NOT_AFILE, targets));
+
+    const vec_t king = vec_load(lanes.pieces[Me][KING]);
+    vec_store(sets[KING_SETS + 0], leap< 9>(king, NOT_HFILE, targets));
+    vec_store(sets[KING_SETS + 1], leap< 8>(king, ALL_SQ, targets));
+    vec_store(sets[KING_SETS + 2], leap< 7>(king, NOT_AFILE, targets));
+    vec_store(sets[KING_SETS + 3], leap< 1>(king, NOT_HFILE, targets));
+    vec_store(sets[KING_SETS + 4], leap<-1>(king, NOT_AFILE, targets));
+    vec_store(sets[KING_SETS + 5], leap<-7>(king, NOT_HFILE, targets));
+    vec_store(sets[KING_SETS + 6], leap<-8>(king, ALL_SQ, targets));
+    vec_store(sets[KING_SETS + 7], leap<-9>(king, NOT_AFILE, targets));
+
+    // Edges: squares which can be entered moving east or west without
+    // wrapping around the board
+    const vec_t east = vec_set1(NOT_AFILE), west = vec_set1(NOT_HFILE);
+    const vec_t queens = vec_load(lanes.pieces[Me][QUEEN]);
+    const vec_t orthogonal = vec_or(vec_load(lanes.pieces[Me][ROOK]), queens);
+    vec_store(sets[ORTHOGONAL_SETS + 0], vec_and(vec_slide< 8>(orthogonal, empty, all), targets));
+    vec_store(sets[ORTHOGONAL_SETS + 1], vec_and(vec_slide<-8>(orthogonal, empty, all), targets));
+    vec_store(sets[ORTHOGONAL_SETS + 2], vec_and(vec_slide< 1>(orthogonal, empty, east), targets));
+    vec_store(sets[ORTHOGONAL_SETS + 3], vec_and(vec_slide<-1>(orthogonal, empty, west), targets));
+    const vec_t diagonal = vec_or(vec_load(lanes.pieces[Me][BISHOP]), queens);
+    vec_store(sets[DIAGONAL_SETS + 0], vec_and(vec_slide< 9>(diagonal, empty, east), targets));
+    vec_store(sets[DIAGONAL_SETS + 1], vec_and(vec_slide< 7>(diagonal, empty, west), targets));
+    vec_store(sets[DIAGONAL_SETS + 2], vec_and(vec_slide<-7>(diagonal, empty, east), targets));
+    vec_store(sets[DIAGONAL_SETS + 3], vec_and(vec_slide<-9>(diagonal, empty, west), targets));
+}
+
+// Plays a random move of Me in every lane still going
+template<int Me>
+void step(lanes_t& lanes, const int side) {
+    alignas(64) uint64_t sets[SETS][VEC_LANES];
+    alignas(64) uint64_t random[VEC_LANES], chosen[VEC_LANES], rank[VEC_LANES], totals[VEC_LANES];
+    generate<Me>(lanes, sets);
+
+    vec_t counts[SETS];
+    vec_t total = vec_set1(0);
+    for (int i = 0; i < SETS; ++i) {
+        counts[i] = vec_popcnt(vec_load(sets[i]));
+        total = vec_add(total, counts[i]);
+    }
+
+    // A random index in [0, total) in each lane, moves being numbered set by
+    // set (31-bit random numbers, so that the product fits the signed multiply)
+    for (int lane = 0; lane < VEC_LANES; ++lane) {
+        random[lane] = rand_uint64() >> 33;
+    }
+    const vec_t index = vec_shift<-31>(vec_mul32(vec_load(random), total));
+
+    // The move is in the set following all the sets which end at or before
+    // its index, and its rank in that set is what's left of the index
+    const vec_t all = vec_set1(ALL_SQ), one = vec_set1(1);
+    vec_t set = vec_set1(0), before = vec_set1(0), end = vec_set1(0);
+    for (int i = 0; i < SETS; ++i) {
+        end = vec_add(end, counts[i]);
+        const vec_t passed = vec_andnot(vec_gt(end, index), all);
+        set = vec_add(set, vec_and(passed, one));
+        before = vec_add(before, vec_and(passed, counts[i]));
+    }
+    vec_store(chosen, set);
+    vec_store(rank, vec_sub(index, before));
+    vec_store(totals, total);
+
+    for (int lane = 0; lane < VEC_LANES; ++lane) {
+        if (lanes.over[lane]) continue;
+        // Without a move (not even a king's), call it a draw
+        if (totals[lane] == 0) {
+            lanes.over[lane] = true;
+            lanes.reward[lane] = 0.0;
+            continue;
+        }
+
+        const int i = chosen[lane];
+        const int shift = Me == BLACK && i < KNIGHT_SETS ? BLACK_PAWN_SHIFTS[i] : SHIFTS[i];
+        const int to = GETLSB(nth_bit(sets[i][lane], rank[lane]));
+        int from = to - shift;
+        if (i >= ORTHOGONAL_SETS) {
+            bb_t own = 0;
+            for (piece_t type = PAWN; type <= KING; ++type) {
+                own |= lanes.pieces[Me][type][lane];
+            }
+            while (!GETBIT(own, from)) {
+                from -= shift;
+            }
+        }
+
+        const bb_t from_bb = SQ_TO_BB(from), to_bb = SQ_TO_BB(to);
+        piece_t moved = PAWN;
+        while (!(lanes.pieces[Me][moved][lane] & from_bb)) {
+            ++moved;
+        }
+        lanes.pieces[Me][moved][lane] ^= from_bb;
+        if (moved == PAWN && (to_bb & (RANK1_BB | RANK8_BB))) {
+            moved = QUEEN;
+        }
+        lanes.pieces[Me][moved][lane] |= to_bb;
+
+        for (piece_t type = PAWN; type <= KING; ++type) {
+            if (lanes.pieces[Me ^ 1][type][lane] & to_bb) {
+                lanes.pieces[Me ^ 1][type][lane] ^= to_bb;
+                if (type == KING) {
+                    lanes.over[lane] = true;
+                    lanes.reward[lane] = Me == side ? 1.0 : -1.0;
+                }
+                break;
+            }
+        }
+    }
+}
+
+} // namespace
+
+
+double lane_playouts(const board_t *board, int plies) {
+    lanes_t lanes = {};
+    for (int colour = BLACK; colour <= WHITE; ++colour) {
+        for (piece_t type = PAWN; type <= KING; ++type) {
+            const bb_t bb = board->bitboards[set_colour(type, colour)];
+            std::fill(lanes.pieces[colour][type], lanes.pieces[colour][type] + VEC_LANES, bb);
+        }
+    }
+
+    const int side = board->turn;
+    int turn = side;
+    for (int ply = 0; ply < plies; ++ply) {
+        if (turn == WHITE) {
+            step<WHITE>(lanes, side);
+        } else {
+            step<BLACK>(lanes, side);
+        }
+        turn ^= 1;
+        if (std::all_of(lanes.over, lanes.over + VEC_LANES, [](bool over) { return over; })) {
+            break;
+        }
+    }
+
+    // Material balance of each lane, for the starting side
+    alignas(64) uint64_t balance[VEC_LANES];
+    vec_t sum = vec_set1(0);
+    for (piece_t type = PAWN; type <= QUEEN; ++type) {
+        const vec_t diff = vec_sub(vec_popcnt(vec_load(lanes.pieces[side][type])),
+                                   vec_popcnt(vec_load(lanes.pieces[side ^ 1][type])));
+        sum = vec_add(sum, vec_mul32(diff, vec_set1(PIECE_VALUES[type])));
+    }
+    vec_store(balance, sum);
+
+    double reward = 0.0;
+    for (int lane = 0; lane < VEC_LANES; ++lane) {
+        reward += lanes.over[lane] ? lanes.reward[lane]
+                                   : 2 * winning_prob(static_cast<int64_t>(balance[lane])) - 1;
+    }
+    return reward / VEC_LANES;
+}
@@ -0,0 +1,32 @@
+#ifndef LANES_H_
+#define LANES_H_
+
+#include "types.h"
+#include "board.h"
+
+/* Lane playouts (experimental)
+ *
+ * Random playouts advanced VEC_LANES at a time, one per lane of a bitboard
+ * vector (see simd.h): 4 with AVX2, 8 with AVX-512 and a single one in scalar
+ * builds. All lanes start from the same position and move in lockstep, so the
+ * side to move is the same in every lane. Pawn pushes and captures, leaper
+ * moves and slider rays are generated for all lanes at once as sets of
+ * destination squares, and the random move is picked by vectorized prefix
+ * sums over the sizes of the sets. Only the move itself is applied lane by
+ * lane.
+ *
+ * To keep the kernel branch-free, moves are pseudo-legal: a playout ends as
+ * soon as a king is captured (lost by its side). Castling and en passant
+ * aren't played and pawns always promote to queens. Playouts which run out of
+ * plies are scored by their material balance.
+ */
+
+/**
+ * @brief Plays VEC_LANES random playouts from the position of board (left
+ * untouched)
+ * @param plies length of the playouts
+ * @return average reward, in [-1, 1], for the side to move in board
+ */
+double lane_playouts(const board_t *board, int plies);
+
+#endif // LANES_H_
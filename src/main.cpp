@@ -61,6 +61,7 @@ int main(int argc, char* argv[]) {
     init_rook_occupancies();
     init_magics<BISHOP>();
     init_magics<ROOK>();
+    init_cuckoo();
 
     // tune();
 
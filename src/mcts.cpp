@@ -1,16 +1,30 @@
 #include "mcts.h"
 
-#include <random>
-#include <vector>
 #include <cmath>
 #include <climits>
+#include <algorithm>
+#include <iomanip>
+#include <array>
+#include <memory>
+#include <vector>
+#include <fstream>
 
 #include "eval.h"
 #include "threads.h"
 #include "sgd.h"
 #include "board.h"
 #include "arena.h"
-#include "categorical.h"
+#include "tablebase.h"
+#include "perf.h"
+#include "trace.h"
+#include "alloc.h"
+#include "rng.h"
+#include "metrics.h"
+#include "output.h"
+#include "treestats.h"
+#include "search.h"
+#include "lanes.h"
+#include "uci.h"
 
 // Global evaluator
 extern eval_t eval;
@@ -18,16 +32,53 @@ extern eval_t eval;
 // Constants (TODO: Tune with self-play?)
 constexpr double UCB_CONST = 0.7;
 constexpr int ROLLOUT_BUDGET = 3;
-constexpr size_t DEFAULT_ARENA_MB = 2048; /* Default size of the arena in MB */
+// Playouts: plies played in quiet positions, and at most in total (extending
+// through exchanges)
+constexpr int PLAYOUT_PLIES = 4;
+constexpr int PLAYOUT_MAX_PLIES = 12;
+// Material advantage (cp) at which a playout stops, the outcome being decided
+constexpr int DECISIVE_MATERIAL = 500;
 constexpr double EPS = 0.5;
 
+// Weight of the implicit minimax values in selection (set for each search)
+double minimax_weight = 0.0;
+
 // Arena allocator 
-Arena arena(DEFAULT_ARENA_MB);
+Arena arena(DEFAULT_HASH_MB);
+// Arena of the tree being searched (self-play keeps one per game)
+Arena *tree = &arena;
 
-template <typename T, typename A>
-int arg_max(std::vector<T, A> const& vec) {
-  return static_cast<int>(std::distance(vec.begin(), max_element(vec.begin(), vec.end())));
-}
+// Playout statistics: lengths in plies, and how many stopped on a decided
+// material balance
+uint64_t playout_lengths[PLAYOUT_MAX_PLIES + 1] = {};
+uint64_t playouts_decided = 0;
+
+/**
+ * @brief Untried moves of a node. They are generated when the node is first
+ * expanded (most leaves never are) and stored in the arena with 2 bytes per
+ * move, rather than as a full movelist_t in every node.
+ */
+typedef struct untried_t {
+    uint16_t *moves = nullptr;
+    uint16_t count = 0;
+
+    size_t size() const { return count; }
+    move_t operator[](int i) const { return moves[i]; }
+    const uint16_t *begin() const { return moves; }
+    const uint16_t *end() const { return moves + count; }
+
+    int find(move_t move) const {
+        for (int i = 0; i < count; ++i) {
+            if (moves[i] == move) return i;
+        }
+        return -1;
+    }
+
+    // O(1), the order of the moves doesn't matter
+    void erase(int i) {
+        moves[i] = moves[--count];
+    }
+} untried_t;
 
 class Node {
 
@@ -43,13 +94,12 @@ public:
         , avg(0)
         , visits(0)
     {
-        // Generate all possible actions (chess moves) from this node
-        generate_moves(board, &this->untried_moves);
+        (void) board; // Moves are only generated on expansion
     }
 
     // Destructor
     ~Node() {
-        for (Node* child : this->children) {
+        for (Node* child = first_child; child != nullptr; child = child->next_sibling) {
             child->~Node();
         }
     }
@@ -58,21 +108,58 @@ public:
     Node* best_child(bool exploration_mode = true);
     double UCB(bool exploration_mode = true);
     void update(double res); // backprop update (increment visits etc.)
+    bool update_minimax();
     inline bool is_terminal() {
-        return children.size() == 0 && is_fully_expanded();
+        return children_no == 0 && is_fully_expanded();
     }
 
     inline bool is_fully_expanded() {
         // REVIEW: Are leaves considered fully expanded?
-        return this->untried_moves.size() == 0;
+        return this->moves_generated && this->untried_moves.size() == 0;
+    }
+
+    /**
+     * @brief Generates the untried moves (on the first expansion)
+     * @param board Board state corresponding to the node
+     * @return false if the arena ran out of space
+     */
+    bool generate_untried(const board_t *board) {
+        movelist_t moves;
+        generate_moves(board, &moves);
+        void *memory = tree->allocate(moves.size() * sizeof(uint16_t));
+        if (memory == nullptr) {
+            return false;
+        }
+        untried_moves.moves = static_cast<uint16_t*>(memory);
+        untried_moves.count = moves.size();
+        std::copy(moves.begin(), moves.end(), untried_moves.moves);
+        moves_generated = true;
+        return true;
+    }
+
+    inline int visit_count() const {
+        return visits;
+    }
+
+    inline double reward() const {
+        return total_reward;
     }
 
     Node *parent;
-    std::vector<Node *> children;
+    // Children form an intrusive linked list, so that expanding a node only
+    // takes memory from the arena
+    Node *first_child = nullptr;
+    Node *next_sibling = nullptr;
+    int children_no = 0;
     // action that got us to this node (for performance reasons only the root
     // stores the actual board state)
     Action a;
-    movelist_t untried_moves;
+    untried_t untried_moves;
+    bool moves_generated = false;
+    // Implicit minimax value: the static evaluation of the node's position
+    // backed up through the expanded children, from the point of view of the
+    // player who made the move (like rewards)
+    double minimax = 0.0;
 private:
     double total_reward;
     double avg;
@@ -82,7 +169,7 @@ private:
 
 /* TODO:
 std::ostream& operator << (std::ostream &o, const Node* node) {
-    return o << "Node; " << node->children.size() << " children; " \
+    return o << "Node; " << node->children_no << " children; " \
     << node->visits << " visits; " << node->total_reward << " reward";
 }
 */
@@ -91,66 +178,158 @@ std::ostream& operator << (std::ostream &o, const Node* node) {
 // REVIEW: Here, we could experiment with multiple rollout policies
 // and report the results?
 
+template<typename List> // movelist_t or untried_t
 [[__always_inline__]] 
-static inline Action random_policy(movelist_t& actions, State *s = NULL) {
+static inline Action random_policy(List& actions, State *s = NULL) {
     (void) s; // Ignore the state if our policy is random
     return actions[rand_uint64() % actions.size()];
 }
 
-static inline Action evaluation_sample_policy(movelist_t& actions, State* s) {
-
-    // Get an evaluation score for each child and treat it as a weight
-    std::vector<double> weights;
-    weights.reserve(actions.size());
-    for (const move_t move : actions) {
-        if (!make_move(s, move)) { // Pseudolegal move generation
-            weights.push_back(0.0);
+// Gets an evaluation score for each child and treats it as a weight (weights
+// needs room for actions.size() elements). Returns the sum of the weights
+static inline double evaluation_weights(movelist_t& actions, State* s, double *weights) {
+    double sum = 0.0;
+    for (size_t i = 0; i < actions.size(); ++i) {
+        weights[i] = 0.0;
+        if (!make_move(s, actions[i])) { // Pseudolegal move generation
             continue;
         }
         // NOTE: After making the move, the evaluation score will be w.r.t.
         // the opponent!
         double weight = (1.0 - winning_prob(evaluate(s, &eval)));
-        weights.push_back(100 * (weight * weight));
-        undo_move(s); 
+        weights[i] = 100 * (weight * weight);
+        sum += weights[i];
+        undo_move(s);
     }
     LOG("Categorical weights:");
-    for (size_t i = 0; i < weights.size(); ++i) {
+    for (size_t i = 0; i < actions.size(); ++i) {
         LOG(move_to_str(actions[i]) << ": " << weights[i]);
     }
+    return sum;
+}
 
-    // Sample from a categorical distribution
-    std::default_random_engine generator;
-    fast_discrete_distribution<int> distribution(weights);
-    size_t sampled = distribution(generator);
+static inline Action evaluation_sample_policy(movelist_t& actions, State* s) {
+    double weights[MAX_MOVES];
+    double sum = evaluation_weights(actions, s, weights);
+
+    // Sample from the categorical distribution by inverting its CDF (a linear
+    // scan is cheap compared to evaluating every child)
+    double target = rand_double() * sum;
+    size_t sampled = 0;
+    while (sampled + 1 < actions.size() && (target -= weights[sampled]) >= 0.0) {
+        ++sampled;
+    }
     LOG("Sampled move " << move_to_str(actions[sampled]));
     return actions[sampled];
 }
 
 static inline Action evaluation_argmax_policy(movelist_t& actions, State* s) {
+    double weights[MAX_MOVES];
+    evaluation_weights(actions, s, weights);
 
-    // Get an evaluation score for each child and treat it as a weight
-    std::vector<double> weights;
-    weights.reserve(actions.size());
-    for (const move_t move : actions) {
-        if (!make_move(s, move)) { // Pseudolegal move generation
-            weights.push_back(0.0);
-            continue;
+    // Greedily choose best
+    size_t sampled = std::max_element(weights, weights + actions.size()) - weights;
+    LOG("Argmax move " << move_to_str(actions[sampled]));
+    return actions[sampled];
+}
+
+/* Move-Average Sampling Technique (MAST)
+ *
+ * The average reward of every move (by side, from and to squares) over the
+ * playouts of the search, from the point of view of the side playing it.
+ * Playouts sample moves from a softmax over these averages, so that moves
+ * which tend to do well anywhere get played more and playouts improve as the
+ * search goes on. Averages are kept in fixed point, their softmax weights
+ * (read off a table on update) in a dense array of their own: sampling costs
+ * a load per move.
+ */
+
+// Rewards are summed in units of 1 / MAST_ONE
+constexpr int MAST_ONE = 1024;
+// Samples per move before its sum and count are halved (keeps the sum within
+// 32 bits)
+constexpr uint32_t MAST_MAX_COUNT = 1 << 16;
+// Softmax temperature (in rewards) and number of weights in its table
+constexpr double MAST_TEMPERATURE = 0.25;
+constexpr int MAST_WEIGHTS = 129;
+// Share of playout moves (out of 256) picked uniformly at random instead
+constexpr uint64_t MAST_EPSILON = 26;
+
+typedef struct mast_entry_t {
+    int32_t sum;
+    uint32_t count;
+} mast_entry_t;
+
+typedef struct alignas(64) mast_t {
+    // Indexed by side, then by from and to squares (the low 12 bits of a move)
+    uint16_t weights[BOTH][SQUARE_NO * SQUARE_NO];
+    mast_entry_t entries[BOTH][SQUARE_NO * SQUARE_NO];
+
+    static int index(move_t move) { return move & 0xfff; }
+    void clear();
+} mast_t;
+
+// One table per search thread
+thread_local mast_t mast;
+
+// exp(average / temperature) for the averages -1..1 in MAST_WEIGHTS steps,
+// scaled so that the smallest weight is still positive
+const auto mast_weights = [] {
+    std::array<uint16_t, MAST_WEIGHTS> weights;
+    for (int i = 0; i < MAST_WEIGHTS; ++i) {
+        const double average = 2.0 * i / (MAST_WEIGHTS - 1) - 1.0;
+        weights[i] = static_cast<uint16_t>(std::lround(UINT16_MAX * std::exp((average - 1.0) / MAST_TEMPERATURE)));
+    }
+    return weights;
+}();
+
+void mast_t::clear() {
+    std::fill_n(&weights[0][0], BOTH * SQUARE_NO * SQUARE_NO, mast_weights[MAST_WEIGHTS / 2]);
+    std::fill_n(&entries[0][0], BOTH * SQUARE_NO * SQUARE_NO, mast_entry_t{0, 0});
+}
+
+void clear_playout_policy() {
+    mast.clear();
+}
+
+// Adds the reward of a playout to the averages of its moves
+void mast_update(const State *s, int first, int side, double reward) {
+    const int update = static_cast<int>(reward * MAST_ONE);
+    for (int i = first; i < s->history_ply; ++i, side ^= 1) {
+        const int index = mast_t::index(s->history[i].move);
+        mast_entry_t& entry = mast.entries[side][index];
+        if (entry.count == MAST_MAX_COUNT) {
+            entry.sum /= 2;
+            entry.count /= 2;
         }
-        // NOTE: After making the move, the evaluation score will be w.r.t.
-        // the opponent!
-        double weight = (1.0 - winning_prob(evaluate(s, &eval)));
-        weights.push_back(100 * (weight * weight));
-        undo_move(s); 
+        entry.sum += (i - first) % 2 ? -update : update;
+        ++entry.count;
+        const int average = entry.sum / static_cast<int32_t>(entry.count);
+        mast.weights[side][index] = mast_weights[(average + MAST_ONE) * (MAST_WEIGHTS - 1) / (2 * MAST_ONE)];
     }
-    LOG("Categorical weights:");
+}
 
-    for (size_t i = 0; i < weights.size(); ++i) {
-        LOG(move_to_str(actions[i]) << ": " << weights[i]);
+// Gibbs sampling over the MAST averages, with uniformly random moves mixed in
+template<typename List>
+static inline Action mast_policy(List& actions, State *s) {
+    const uint64_t r = rand_uint64();
+    if ((r & 0xff) < MAST_EPSILON) {
+        return actions[(r >> 8) % actions.size()];
     }
 
-    // Greedily choose best
-    size_t sampled = arg_max(weights);
-    LOG("Argmax move " << move_to_str(actions[sampled]));
+    const uint16_t *side_weights = mast.weights[s->turn];
+    uint32_t weights[MAX_MOVES];
+    uint64_t sum = 0;
+    for (size_t i = 0; i < actions.size(); ++i) {
+        weights[i] = side_weights[mast_t::index(actions[i])];
+        sum += weights[i];
+    }
+    // Scales 32 random bits to [0, sum) without a division
+    uint64_t target = ((r >> 32) * sum) >> 32;
+    size_t sampled = 0;
+    while (target >= weights[sampled]) {
+        target -= weights[sampled++];
+    }
     return actions[sampled];
 }
 
@@ -161,7 +340,7 @@ static inline Action evaluation_argmax_policy(movelist_t& actions, State* s) {
  * 
  * @return Node* or nullptr if no legal action could be taken
  */
-Node* select_and_insert(Node* node, State* s, Action (*policy)(movelist_t&, State*)) {
+Node* select_and_insert(Node* node, State* s, Action (*policy)(untried_t&, State*)) {
 
     assert(node != nullptr);
     assert(s != nullptr);
@@ -252,16 +431,32 @@ void backprop(double reward, Node *node, searchinfo_t *info) {
 
     if (search_stopped(info)) return;
 
+    // The value of a terminal node is exact (the reward is from the point of
+    // view of its side to move)
+    if (minimax_weight > 0.0 && node->is_terminal()) {
+        node->minimax = -reward;
+    }
+    // Minimax values are backed up until one doesn't change
+    bool minimax_changed = minimax_weight > 0.0;
+
     Node *curr = node;
     while (curr != nullptr) {
         reward *= -1.0;
         curr->update(reward);
+        if (minimax_changed && curr->parent != nullptr) {
+            minimax_changed = curr->parent->update_minimax();
+        }
         curr = curr->parent;
     }
 }
 
 double Node::UCB(bool exploration_mode) {
     double ucb = static_cast<double>(total_reward) / (visits + 1);
+    // Implicit minimax backups (Lanctot et al., 2014): the playout average is
+    // blended with the minimax value of the static evaluations
+    if (minimax_weight > 0.0) {
+        ucb = (1.0 - minimax_weight) * ucb + minimax_weight * minimax;
+    }
     // double ucb = this->avg;
     if (exploration_mode)
         // Avoid div-by-zero
@@ -277,7 +472,7 @@ Node *Node::best_child(bool exploration_mode) {
     double best_value = static_cast<double>(INT_MIN);
     Node *best = nullptr;
 
-    for (Node* child : this->children) {
+    for (Node* child = first_child; child != nullptr; child = child->next_sibling) {
         ucb = child->UCB(exploration_mode);
         if (ucb > best_value) {
             best_value = ucb;
@@ -294,22 +489,36 @@ Node *Node::best_child(bool exploration_mode) {
 
 Node *Node::insert_child(move_t move, const board_t *board) {
     // Node *child = new Node(board, move, this);
-    void *memory = arena.allocate(sizeof(Node));
+    void *memory = tree->allocate(sizeof(Node));
     Node *child = memory ? new (memory) Node(board, move, this) : nullptr;
 
     // Mark move as tried
-    for (auto it = this->untried_moves.begin(); it != this->untried_moves.end(); ++it) {
-        if (*it == move) {
-            untried_moves.erase(it);
-            break;
-        }
+    const int tried = untried_moves.find(move);
+    if (tried >= 0) {
+        untried_moves.erase(tried);
     }
 
     // Store the child within the node
-    this->children.push_back(child);
+    if (child != nullptr) {
+        child->next_sibling = first_child;
+        first_child = child;
+        ++children_no;
+    }
     return child;
 }
 
+// Sets the minimax value to the best one of the children, returns whether
+// it changed
+bool Node::update_minimax() {
+    double best = -1.0;
+    for (Node* child = first_child; child != nullptr; child = child->next_sibling) {
+        best = MAX(best, child->minimax);
+    }
+    const bool changed = minimax != -best;
+    minimax = -best;
+    return changed;
+}
+
 void Node::update(double reward) {
 
     // See 184 Lecture slides on AlphaZero
@@ -335,6 +544,10 @@ Action prior_prob(movelist_t& actions) {
     return random_policy(actions);
 }
 
+bool resize_tree(size_t megabytes) {
+    return arena.resize(megabytes);
+}
+
 // TODO: Review this for correctness
 Node *insert_node_with_tree_policy(Node *root, State *s) {
     assert(root != nullptr);
@@ -379,10 +592,7 @@ Node *select(Node *root, State *s, searchinfo_t *info) {
 
     Node *node = root;
     while (!node->is_terminal()) {
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_real_distribution<> dis(0, 1);
-        if (node->is_fully_expanded() || (node->children.size() >= 1 && dis(gen) <= EPS)) {
+        if (node->is_fully_expanded() || (node->children_no >= 1 && rand_double() <= EPS)) {
             node = node->best_child(true);
             /* Make sure the state follows the path along the tree as well */
             make_move(s, node->a);
@@ -401,7 +611,8 @@ Node *select(Node *root, State *s, searchinfo_t *info) {
  * @param moves Allowed moves
  * @return Action played on success, NULLMV otherwise.
  */
-Action play_legal(State *s, Action (*policy)(movelist_t&, State*), movelist_t& moves) {
+template<typename List>
+Action play_legal(State *s, Action (*policy)(List&, State*), List& moves) {
 
     // Pick a move according to policy 
     // (REVIEW: We might want the policy to take in the state too?)
@@ -436,90 +647,421 @@ Node *expand(Node *node, State *s, searchinfo_t *info) {
     if (node->is_terminal() || node->is_fully_expanded())
         return node;
 
-    // Check if enough memory to expand the tree
-    if (!arena.has_space(sizeof(Node))) {
+    // Check if enough memory to expand the tree (and to store the node's
+    // moves, if this is its first expansion)
+    if (!tree->has_space(sizeof(Node) + MAX_MOVES * sizeof(uint16_t))) {
         LOG("Arena ran out of space!\n");
         return node;
     }
 
+    if (!node->moves_generated && !node->generate_untried(s)) {
+        return node;
+    }
+
     // Attempt to expand the node (note: might mutate s)
     Action a = play_legal(s, &random_policy, node->untried_moves);
     if (a != NULLMV) {
         ++info->nodes;
         info->seldepth = std::max(info->seldepth, s->ply);
-        return node->insert_child(a, s);
+        Node *child = node->insert_child(a, s);
+        if (child != nullptr && minimax_weight > 0.0) {
+            // The evaluation is for the side to move in the child
+            child->minimax = 1.0 - 2 * winning_prob(evaluate(s, &eval));
+        }
+        return child;
     }
 
     return node;
 }
 
-/**
- * @brief Perform a light rollout simulation (playout).
- *  Like rollout(), but doesn't insert any new nodes into the tree
- * @param node Node to start the playout from
- * @param s Board state corresponding to @param node
- * @param info Search information, including movetime
- * @return double The reward, r \in [0, 1] for the side to move in state s
- */
-double simulate(State *s, searchinfo_t *info) {
-    assert(s != nullptr);
+// Material balance (cp) from White's point of view, a cheap stand-in for the
+// evaluation while deciding whether to go on with a playout
+inline int material(const board_t *board) {
+    constexpr int values[] = { 0, 100, 300, 300, 500, 900 };
+    int balance = 0;
+    for (piece_t type = PAWN; type <= QUEEN; ++type) {
+        balance += values[type] * (CNT(board->bitboards[set_colour(type, WHITE)])
+                                 - CNT(board->bitboards[set_colour(type, BLACK)]));
+    }
+    return balance;
+}
 
-    if (search_stopped(info)) return 0;
+// Outcome of a playout: either a reward known right away, or a final position
+// left to evaluate (see playout_reward)
+typedef struct playout_t {
+    double reward = 0.0;
+    bool evaluate = false;
+    // The side to move in the final position isn't the one the playout
+    // started with
+    bool flipped = false;
+    // The side to move in the final position can claim at least a draw
+    bool can_repeat = false;
+} playout_t;
+
+// Plays out the position of s (see simulate), leaving the evaluation of the
+// final position to the caller
+playout_t play_out(State *s, searchinfo_t *info) {
 
     // We'll return the reward for the player to move in state s
     int color = s->turn;
 
-    // Perform rollout according to chosen policy (we use a random one for now)
-    Action a;
+    // Positions covered by the tablebases need no rollout
+    int wdl;
+    if (tb_probe(s, &wdl, nullptr)) {
+        ++info->tbhits;
+        return { static_cast<double>(wdl) };
+    }
+
+    // Perform rollout according to chosen policy (we use a random one for now).
+    // The playout stops early once the material balance decides the game, and
+    // goes on past its budget while the last capture can be answered, so that
+    // the evaluation isn't taken in the middle of an exchange
+    Action a = NULLMV;
     movelist_t moves;
-    int budget = ROLLOUT_BUDGET;
-    do {
-        generate_moves(s, &moves);
-        a = play_legal(s, &random_policy, moves);
-    } while (a != NULLMV && budget --> 0);
+    int plies = 0;
+    bool terminal = false, can_repeat = false;
+    // Square of the last capture (NO_SQ if the last move wasn't one)
+    square_t captured_on = NO_SQ;
+    while (true) {
+        // Repetitions and the fifty move rule end the playout in a draw
+        if (s->ply && (is_repetition(s) || s->fifty_move >= 100)) {
+            ++playout_lengths[plies];
+            return { 0.0 };
+        }
+        // If the side to move can repeat a position, it can claim at least a
+        // draw: there's no need to play the line out
+        if ((can_repeat = has_game_cycle(s))) {
+            break;
+        }
+        const bool quiet = captured_on == NO_SQ;
+        if (quiet && std::abs(material(s)) >= DECISIVE_MATERIAL) {
+            ++playouts_decided;
+            break;
+        }
+        if (plies >= PLAYOUT_MAX_PLIES || (plies >= PLAYOUT_PLIES && quiet)) {
+            break;
+        }
+
+        if (plies < PLAYOUT_PLIES) {
+            generate_moves(s, &moves);
+        } else {
+            // Extension: recaptures only
+            moves.clear();
+            generate_noisy(s, &moves);
+            for (int i = moves.size() - 1; i >= 0; --i) {
+                if (get_to(moves[i]) != captured_on) {
+                    moves.erase(i);
+                }
+            }
+            if (moves.size() == 0) {
+                break;
+            }
+        }
+        a = play_legal(s, &mast_policy, moves);
+        if (a == NULLMV) {
+            // Out of legal moves (but not necessarily out of recaptures)
+            terminal = plies < PLAYOUT_PLIES;
+            break;
+        }
+        ++plies;
+        captured_on = is_capture(a) ? get_to(a) : NO_SQ;
+    }
+    ++playout_lengths[plies];
 
     // 1) If terminal, check who won the rollout
-    if (a == NULLMV) {
+    if (terminal) {
         // If after rollout root player is in check and node is terminal (no moves),
         // we've been mated        
         if (is_in_check(s, color)) {
-            return -1; 
+            return { -1.0 }; 
         } else if (is_in_check(s, color ^ 1)) { // if opponent got mated
-            return 1;
+            return { 1.0 };
         } else {
-            return 0; // stalemate (i.e. draw)
+            return { 0.0 }; // stalemate (i.e. draw)
         }
     }
-    /* 2) Otherwise, use the evaluation function as a heuristic Note 1: This
-    evaluation is from the POV of the side-to-move at the *leaf node* we reached
-    during rollout. We take care to flip it appropriately to correspond to the
+    // 2) Otherwise, the final position is evaluated
+    return { 0.0, true, s->turn != color, can_repeat };
+}
+
+// Reward of a playout whose final position evaluates to score
+double playout_reward(const playout_t& playout, int score) {
+    /* Use the evaluation function as a heuristic Note 1: This evaluation is
+    from the POV of the side-to-move at the *leaf node* we reached during
+    rollout. We take care to flip it appropriately to correspond to the
     evaluation from the POV of the root state s player. Note 2: We convert this
     centipawn score into a winning probability estimate with sigmoid */
-    int static_eval_score = evaluate(s, &eval);
-    static_eval_score *= 2*(s->turn == color)-1;
-    return 2 * winning_prob(static_eval_score) - 1;
+    if (playout.can_repeat) {
+        score = MAX(score, 0);
+    }
+    if (playout.flipped) {
+        score = -score;
+    }
+    return 2 * winning_prob(score) - 1;
+}
+
+/**
+ * @brief Perform a light rollout simulation (playout).
+ *  Like rollout(), but doesn't insert any new nodes into the tree
+ * @param node Node to start the playout from
+ * @param s Board state corresponding to @param node
+ * @param info Search information, including movetime
+ * @return double The reward, r \in [0, 1] for the side to move in state s
+ */
+double simulate(State *s, searchinfo_t *info) {
+    assert(s != nullptr);
+
+    if (search_stopped(info)) return 0;
+
+    if (info->lane_playouts) {
+        return lane_playouts(s, PLAYOUT_PLIES);
+    }
+
+    const int side = s->turn, first = s->history_ply;
+    const playout_t playout = play_out(s, info);
+    const double reward = playout.evaluate ? playout_reward(playout, evaluate(s, &eval))
+                                           : playout.reward;
+    mast_update(s, first, side, reward);
+    return reward;
 }
 
 
+// Appends the moves from the root to node, followed by the most visited
+// children below it
+void append_pv(line_t& line, const Node *node) {
+    const Node *path[MAX_DEPTH];
+    int length = 0;
+    for (const Node *n = node; n->parent != nullptr && length < MAX_DEPTH; n = n->parent) {
+        path[length++] = n;
+    }
+    while (length--) {
+        line << ' ' << move_to_str(path[length]->a);
+    }
+    for (const Node *n = node->first_child; n != nullptr; ) {
+        const Node *most_visited = n;
+        for (; n != nullptr; n = n->next_sibling) {
+            if (n->visit_count() > most_visited->visit_count()) {
+                most_visited = n;
+            }
+        }
+        line << ' ' << move_to_str(most_visited->a);
+        n = most_visited->first_child;
+    }
+}
+
 /**
- * @brief Writes search information to stdout
+ * @brief Writes search information to stdout: the line of the best move or,
+ * with MultiPV, the lines of the most visited root children
  * @param root Root node of the MCTS search tree
  * @param searchinfo_t* Search information including e.g. # of nodes in the tree
+ * @param best the move to report (the best child by UCB if null)
  */
-void print_MCTS_info(Node *root, searchinfo_t *info) {
-    // We only want to update periodically
-    if (info->nodes % 10000 != 0) 
-        return;
+void print_MCTS_info(Node *root, searchinfo_t *info, Node *best = nullptr) {
+    Node *lines[MAX_MOVES];
+    int lines_no = 1;
+    if (info->multipv <= 1) {
+        lines[0] = best ? best : root->best_child(false);
+    } else {
+        lines_no = 0;
+        for (Node* child = root->first_child; child != nullptr; child = child->next_sibling) {
+            lines[lines_no++] = child;
+        }
+        std::sort(lines, lines + lines_no, [](const Node *a, const Node *b) {
+            return a->visit_count() > b->visit_count();
+        });
+        lines_no = MIN(lines_no, info->multipv);
+    }
+
+    trace_instant("info", info->nodes);
+    metrics_update(info, tree->size());
+    const uint64_t elapsed = now() - info->start;
+    for (int i = 0; i < lines_no; ++i) {
+        // Calculate the score assuming the move is played
+        double ucb = lines[i]->UCB(false);
+
+        // Print the info line (we make sure to scale the cp score back)
+        line_t line;
+        line << "info depth " << info->seldepth;
+        if (info->multipv > 1) {
+            line << " multipv " << i + 1;
+        }
+        line << " score cp " << centipawn_from_prob((ucb + 1) / 2.0) \
+             << " nodes " << info->nodes \
+             << " time " << elapsed \
+             << " pv";
+        append_pv(line, lines[i]);
+        output(line);
+    }
+}
 
-    // Calculate the score assuming bestmove is played
-    Node* best_child = root->best_child(false);
-    double ucb = best_child->UCB(false);
+/**
+ * @brief Exports the subtree below node in pre-order (see treestats.h)
+ * @param s Board state corresponding to @param node
+ * @param parent Record index of the node's parent
+ * @param depth Plies from the root
+ */
+void export_subtree(const Node *node, State *s, uint32_t parent, int depth) {
+    const uint32_t index = treestats_write({
+        .key = s->key,
+        .reward = node->reward(),
+        .parent = parent,
+        .visits = static_cast<uint32_t>(node->visit_count()),
+        .move = static_cast<uint16_t>(node->a),
+        .depth = static_cast<uint16_t>(depth),
+        .snapshot = treestats_snapshot()
+    });
+    for (const Node *child = node->first_child; child != nullptr; child = child->next_sibling) {
+        make_move(s, child->a);
+        export_subtree(child, s, index, depth + 1);
+        undo_move(s, child->a);
+    }
+}
+
+void export_tree(const Node *root, State *s) {
+    trace_begin("tree export");
+    export_subtree(root, s, treestats_next_index(), 0);
+    treestats_end_snapshot();
+    trace_end("tree export");
+}
 
-    // Print the info line (we make sure to scale the cp score back)
-    std::cout << "info depth " << info->seldepth \
-              << " score cp " << centipawn_from_prob((ucb + 1) / 2.0) \
-              << " nodes " << info->nodes \
-              << " pv " << move_to_str(best_child->a) << std::endl;
+void clear_playout_stats() {
+    std::fill(playout_lengths, playout_lengths + PLAYOUT_MAX_PLIES + 1, 0);
+    playouts_decided = 0;
+}
+
+void print_playout_stats() {
+    uint64_t playouts = 0;
+    for (uint64_t count : playout_lengths) {
+        playouts += count;
+    }
+    playouts = MAX(playouts, 1ULL);
+    std::cout << "playout length (plies):";
+    for (int length = 0; length <= PLAYOUT_MAX_PLIES; ++length) {
+        std::cout << ' ' << length << ':' << std::fixed << std::setprecision(1)
+                  << 100.0 * playout_lengths[length] / playouts << '%';
+    }
+    std::cout << "\nplayouts decided by material: "
+              << 100.0 * playouts_decided / playouts << '%' << std::endl;
+}
+
+/* Gumbel root search (Danihelka et al., 2022)
+ *
+ * With few playouts, UCB spreads them over too many root moves for their
+ * averages to mean much. Instead, GUMBEL_ACTIONS root moves are sampled
+ * without replacement (Gumbel-top-k), with a quiescence search after each
+ * move as its prior, and Sequential Halving splits the playouts between them:
+ * every phase visits the remaining moves equally often, then keeps the better
+ * half by prior, Gumbel noise and playout average. The tree policy is
+ * unchanged below the root.
+ */
+
+constexpr int GUMBEL_ACTIONS = 16;
+// Evaluation difference (cp) between moves whose priors differ by a factor e
+constexpr double GUMBEL_PRIOR_SCALE = 100.0;
+// Scale of the Gumbel noise (1 samples from the priors, 0 takes the best ones)
+constexpr double GUMBEL_NOISE = 0.3;
+// Scaling of the playout averages against the priors, which grows with the
+// number of visits
+constexpr double GUMBEL_C_VISIT = 50.0;
+constexpr double GUMBEL_C_SCALE = 0.3;
+// Playouts assumed when neither time nor playouts are limited
+constexpr uint64_t GUMBEL_DEFAULT_BUDGET = 1000;
+
+/**
+ * @brief Picks the root move with Sequential Halving over Gumbel-top-k
+ * sampled moves
+ * @param playout runs a playout through the given root child
+ * @param stopped checks whether the search is over
+ * @return the chosen root child, nullptr if the root has none
+ */
+template<typename Playout, typename Stopped>
+Node *sequential_halving(Node *root, board_t *board, searchinfo_t *info,
+                         Playout& playout, Stopped& stopped) {
+    // All root moves are needed up front
+    const board_t root_board = *board;
+    while (!root->is_fully_expanded() && !stopped()) {
+        Node *child = expand(root, board, info);
+        *board = root_board;
+        if (child == root || child == nullptr) break; // out of memory
+    }
+
+    struct candidate_t {
+        Node *child;
+        // Prior logit plus Gumbel noise
+        double score;
+        // With the transformed playout average
+        double total;
+    };
+    candidate_t candidates[MAX_MOVES];
+    int count = 0;
+    // Priors come from a quiescence search after each move (not counted as
+    // nodes of the tree, nor against its limit)
+    const uint64_t nodes = info->nodes, node_limit = info->node_limit;
+    info->node_limit = 0;
+    stack_t stack[MAX_DEPTH];
+    for (Node *child = root->first_child; child != nullptr; child = child->next_sibling) {
+        make_move(board, child->a);
+        const double logit = -quiescence(-oo, +oo, board, info, stack) / GUMBEL_PRIOR_SCALE;
+        *board = root_board;
+        const double u = MAX(rand_double(), 1e-12);
+        candidates[count++] = { child, logit - GUMBEL_NOISE * std::log(-std::log(u)), 0.0 };
+    }
+    info->nodes = nodes;
+    info->node_limit = node_limit;
+    if (count == 0) {
+        return nullptr;
+    }
+
+    // Gumbel-top-k: the best scores are a sample of moves without replacement
+    auto by_score = [](const candidate_t& a, const candidate_t& b) { return a.score > b.score; };
+    auto by_total = [](const candidate_t& a, const candidate_t& b) { return a.total > b.total; };
+    std::sort(candidates, candidates + count, by_score);
+    count = MIN(count, GUMBEL_ACTIONS);
+
+    // Scores with the transformed playout averages,
+    // sigma(q) = (c_visit + max N) * c_scale * q with q in [0, 1]
+    auto score = [&]() {
+        int max_visits = 0;
+        for (int i = 0; i < count; ++i) {
+            max_visits = MAX(max_visits, candidates[i].child->visit_count());
+        }
+        for (int i = 0; i < count; ++i) {
+            const double q = (candidates[i].child->UCB(false) + 1.0) / 2.0;
+            candidates[i].total = candidates[i].score + (GUMBEL_C_VISIT + max_visits) * GUMBEL_C_SCALE * q;
+        }
+    };
+
+    const int phases = std::ceil(std::log2(count));
+    for (int phase = 0; phase < phases && count > 1 && !stopped(); ++phase) {
+        if (info->time_set && !info->node_limit) {
+            // Each phase gets an equal share of the time left, spent visiting
+            // the moves in turn
+            const uint64_t phase_end = now() + (info->end - MIN(now(), info->end)) / (phases - phase);
+            while (now() < phase_end && !stopped()) {
+                for (int i = 0; i < count; ++i) {
+                    playout(candidates[i].child);
+                }
+            }
+        } else {
+            // Each phase gets an equal share of the playouts left
+            const uint64_t budget = info->node_limit ? info->node_limit : GUMBEL_DEFAULT_BUDGET;
+            const uint64_t visits = MAX(1ULL, (budget - MIN(info->playouts, budget)) / ((phases - phase) * count));
+            for (int i = 0; i < count; ++i) {
+                for (uint64_t n = 0; n < visits && !stopped(); ++n) {
+                    playout(candidates[i].child);
+                }
+            }
+        }
+
+        // Keep the better half
+        score();
+        std::sort(candidates, candidates + count, by_total);
+        count = (count + 1) / 2;
+    }
+
+    // The remaining move with the best score (if stopped early)
+    score();
+    return std::min_element(candidates, candidates + count, by_total)->child;
 }
 
 /*  
@@ -549,63 +1091,165 @@ void MCTS_Search(board_t* board, searchinfo_t *info) {
     // Set up the MCTS Tree
     // Node* root = new Node(board, NULLMV, nullptr);
     // TODO: Cleanup
+    trace_instant("arena reset");
+    tree = &arena;
     arena.reset();
+    mast.clear();
+    minimax_weight = info->minimax_weight / 100.0;
     void *memory = arena.allocate(sizeof(Node));
     Node *root = memory ? new (memory) Node(board, NULLMV, nullptr) : nullptr;
     LOG("Root is at " << root);
 
+    root->generate_untried(board);
+
+    // Only expand the root moves given by 'go searchmoves' (unless none of
+    // them are possible)
+    untried_t& moves = root->untried_moves;
+    auto is_searchmove = [info](move_t move) { return info->searchmoves.find(move) >= 0; };
+    if (std::any_of(moves.begin(), moves.end(), is_searchmove)) {
+        for (int i = moves.size() - 1; i >= 0; --i) {
+            if (!is_searchmove(moves[i])) {
+                moves.erase(i);
+            }
+        }
+    }
+
+    // Hardware counters accumulated per phase (when enabled)
+    enum { SELECTION, EXPANSION, SIMULATION, BACKPROPAGATION, REPORTING, PHASE_NO };
+    constexpr const char *phase_names[PHASE_NO] = {
+        "selection", "expansion", "simulation", "backpropagation", "reporting"
+    };
+    perf_sample_t perf_phase[PHASE_NO], perf_last;
+    if (perf_enabled) perf_read(&perf_last);
+
+    // Playouts are traced in batches, tracing each one would flood the buffer
+    constexpr uint64_t TRACE_BATCH = 1024;
+    trace_begin("playouts");
+    const alloc_stats_t allocs_start = alloc_stats();
+
     /* Search */
-    Node* node;
-    double reward;
-    while (!search_stopped(info)) {
+    // Info lines are sent at a fixed interval of wall-clock time
+    uint64_t next_info = now() + INFO_INTERVAL_MS;
+    // Playouts at the last info line (the final one isn't repeated)
+    uint64_t info_playouts = 0;
+    uint64_t next_export = now() + treestats_interval;
+    // One playout through the given child of the root (the tree policy picks
+    // it if null)
+    auto playout = [&](Node *root_child) {
+        if (++info->playouts % TRACE_BATCH == 0) {
+            trace_end("playouts", TRACE_BATCH);
+            trace_begin("playouts");
+        }
+
         // 1) Selection
-        node = select(root, board, info);
+        Node *node = root;
+        if (root_child != nullptr) {
+            make_move(board, root_child->a);
+            node = root_child;
+        }
+        node = select(node, board, info);
+        perf_lap(&perf_last, &perf_phase[SELECTION]);
 
         // 2) Expansion (We skip this step when OOM)
         node = expand(node, board, info);
+        perf_lap(&perf_last, &perf_phase[EXPANSION]);
 
         // 3) Simulation
-        reward = simulate(board, info);
+        double reward = simulate(board, info);
+        perf_lap(&perf_last, &perf_phase[SIMULATION]);
 
         // 4) Backpropagation
         backprop(reward, node, info);
+        perf_lap(&perf_last, &perf_phase[BACKPROPAGATION]);
 
         // 5) Update client with current search information
-        print_MCTS_info(root, info);
+        if (now() >= next_info) {
+            print_MCTS_info(root, info);
+            info_playouts = info->playouts;
+            next_info = now() + INFO_INTERVAL_MS;
+        }
+        perf_lap(&perf_last, &perf_phase[REPORTING]);
 
         // 6) Restore board state after traversing up to the root
         *board = root_board;
+
+        // 7) Periodic snapshots of the tree (when exporting)
+        if (treestats_enabled && treestats_interval && now() >= next_export) {
+            export_tree(root, board);
+            next_export = now() + treestats_interval;
+        }
+    };
+    // The playout limit also applies when the tree is out of memory (and no
+    // nodes get added)
+    auto stopped = [info] {
+        return search_stopped(info) || (info->node_limit && info->playouts >= info->node_limit);
+    };
+
+    Node *best = info->gumbel_root ? sequential_halving(root, board, info, playout, stopped) : nullptr;
+    while (!stopped()) {
+        playout(best);
     }
+    trace_end("playouts", info->playouts % TRACE_BATCH);
+    trace_instant("stopped", info->playouts);
 
     // Figure out the best move at root of the tree (current game state)
     // TODO: We should report the entire principal variation of moves by
     // convention
                                         // ignore the exploration term for UCB
-    move_t best_move = root->best_child(false)->a;
+    if (best == nullptr) {
+        best = root->best_child(false);
+    }
+    move_t best_move = best->a;
+
+    if (alloc_tracking) {
+        alloc_stats_t allocs = alloc_stats() - allocs_start;
+        std::cout << "info string allocations " << allocs.count
+                  << " bytes " << allocs.bytes
+                  << " per playout " << static_cast<double>(allocs.count) / MAX(info->playouts, 1ULL)
+                  << " per node " << static_cast<double>(allocs.count) / MAX(info->nodes, 1ULL)
+                  << std::endl;
+    }
+
+    if (perf_enabled) {
+        for (int phase = 0; phase < PHASE_NO; ++phase) {
+            perf_print(phase_names[phase], perf_phase[phase]);
+        }
+    }
 
-    std::cout << "bestmove " << move_to_str(best_move) << '\n';
+    // Unless it would be the same as the last one (the root move picked by
+    // Sequential Halving may differ from the most visited one)
+    if (info->playouts != info_playouts || info->gumbel_root) {
+        print_MCTS_info(root, info, best);
+    }
+    line_t line;
+    output(line << "bestmove " << move_to_str(best_move), true);
+    trace_instant("bestmove");
+
+    if (treestats_enabled) {
+        export_tree(root, board);
+    }
 
     #ifdef DEBUG
     std::cout << "info string UCB scores at the root: ";
-    for (Node* child : root->children) {
+    for (Node* child = root->first_child; child != nullptr; child = child->next_sibling) {
         std::cout << move_to_str(child->a) << ':' << child->UCB(false) << ' ';
     }
     std::cout << std::endl;
 
     std::cout << "info string w/ exploration term on: ";
-    for (Node* child : root->children) {
+    for (Node* child = root->first_child; child != nullptr; child = child->next_sibling) {
         std::cout << move_to_str(child->a) << ':' << child->UCB(true) << ' ';
     }
     std::cout << std::endl;
 
     std::cout << "info string visits at root: ";
-    for (Node* child : root->children) {
+    for (Node* child = root->first_child; child != nullptr; child = child->next_sibling) {
         std::cout << child->visits << ' ';
     }
     std::cout << std::endl;
 
     std::cout << "info string accumulated reward at root: ";
-    for (Node* child : root->children) {
+    for (Node* child = root->first_child; child != nullptr; child = child->next_sibling) {
         std::cout << child->total_reward << ' ';
     }
     std::cout << std::endl;
@@ -618,3 +1262,207 @@ void MCTS_Search(board_t* board, searchinfo_t *info) {
     assert(check(board));
     LOG("Cleanup checks done");
 }
+
+
+/* Self-play
+ *
+ * Plays MCTS games against itself and writes out their positions for the
+ * tuner. Many games are played at once on one thread, in lockstep: every game
+ * searches its move with the same number of playouts, and each playout is run
+ * in all of them before the next one. The final positions of a round of
+ * playouts are evaluated together, as one batch. Each game has its own tree
+ * (in an arena of its own), the MAST table is shared.
+ *
+ * With the handcrafted evaluation, a batch costs as much as its positions do
+ * one by one, while the trees of many games don't fit in the caches the way a
+ * single one does: one game at a time is faster. Lockstep pays off once the
+ * evaluation gets cheaper per position in batches.
+ */
+
+namespace {
+
+// Random plies played from the starting position (so that games differ)
+constexpr int SELFPLAY_OPENING_PLIES = 8;
+// Games are adjudicated drawn after this many plies
+constexpr int SELFPLAY_MAX_PLIES = 400;
+
+typedef struct game_t {
+    board_t board;
+    // Moves made before the search (the root of the tree)
+    int root_ply = 0;
+    std::unique_ptr<Arena> arena;
+    Node *root = nullptr;
+    bool active = false;
+    int plies = 0;
+    // Positions played so far, with their side to move
+    std::vector<std::pair<std::string, int>> positions;
+    // The playout in flight: its leaf, where it ended, and the evaluation of
+    // its final position
+    Node *leaf = nullptr;
+    int side = WHITE, first = 0;
+    playout_t playout;
+    int score = 0;
+} game_t;
+
+bool has_legal_move(board_t *board) {
+    movelist_t moves;
+    generate_moves(board, &moves);
+    for (move_t move : moves) {
+        if (make_move(board, move)) {
+            undo_move(board, move);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Score of the game for White (1, 0.5 or 0), or -1 if it isn't over
+double game_result(game_t& game) {
+    board_t *board = &game.board;
+    if (!has_legal_move(board)) {
+        if (!is_in_check(board, board->turn)) {
+            return 0.5;
+        }
+        return board->turn == WHITE ? 0.0 : 1.0;
+    }
+    if (is_repetition(board) || board->fifty_move >= 100 || game.plies >= SELFPLAY_MAX_PLIES) {
+        return 0.5;
+    }
+    return -1;
+}
+
+void start_game(game_t& game) {
+    movelist_t moves;
+    do {
+        setup(&game.board, start_FEN);
+        for (int ply = 0; ply < SELFPLAY_OPENING_PLIES; ++ply) {
+            generate_moves(&game.board, &moves);
+            if (play_legal(&game.board, &random_policy, moves) == NULLMV) {
+                break;
+            }
+        }
+        game.plies = 0;
+    } while (game_result(game) >= 0);
+    game.positions.clear();
+    game.active = true;
+}
+
+// Plays the move found by the search, returns whether the game is over (with
+// its score for White)
+bool play_move(game_t& game, double *result) {
+    board_t *board = &game.board;
+    const move_t move = game.root->best_child(false)->a;
+    game.root->~Node();
+    game.positions.emplace_back(to_fen(board), board->turn);
+    make_move(board, move);
+    ++game.plies;
+    // Only the moves since the last irreversible one matter (for repetitions),
+    // starting over keeps the history short
+    if (board->fifty_move == 0) {
+        setup(board, to_fen(board));
+    }
+    *result = game_result(game);
+    return *result >= 0;
+}
+
+} // namespace
+
+void MCTS_selfplay(searchinfo_t *info, int games_no, int playouts, int concurrent, const std::string& path) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cout << "info string Cannot open " << path << std::endl;
+        return;
+    }
+    // Positions with the result for their side to move, in the tuner's format
+    file << "fen,result\n";
+
+    info->clear();
+    info->state = ENGINE_SEARCHING;
+    info->time_set = false;
+    info->node_limit = 0;
+    minimax_weight = find_option("Minimax Weight")->value / 100.0;
+    const bool lanes = find_option("Lane Playouts")->value;
+
+    // The games share the memory of the tree
+    concurrent = MAX(1, MIN(concurrent, games_no));
+    const size_t arena_MB = MAX(1UL, (arena.capacity() >> 20) / concurrent);
+    std::vector<game_t> games(concurrent);
+    for (game_t& game : games) {
+        game.arena = std::make_unique<Arena>(arena_MB);
+        start_game(game);
+    }
+
+    const uint64_t start = now();
+    int started = concurrent, finished = 0;
+    uint64_t positions = 0;
+    while (finished < games_no) {
+        // A new search in every game
+        mast.clear();
+        for (game_t& game : games) {
+            if (!game.active) continue;
+            tree = game.arena.get();
+            tree->reset();
+            game.board.ply = 0;
+            game.root_ply = game.board.history_ply;
+            game.root = new (tree->allocate(sizeof(Node))) Node(&game.board, NULLMV, nullptr);
+            game.root->generate_untried(&game.board);
+        }
+
+        for (int playout = 0; playout < playouts; ++playout) {
+            // Tree walks and playouts, game after game
+            for (game_t& game : games) {
+                if (!game.active) continue;
+                tree = game.arena.get();
+                game.leaf = expand(select(game.root, &game.board, info), &game.board, info);
+                game.side = game.board.turn;
+                game.first = game.board.history_ply;
+                // The lane kernel leaves the board as it is, its reward is
+                // known right away
+                game.playout = lanes ? playout_t{lane_playouts(&game.board, PLAYOUT_PLIES)}
+                                     : play_out(&game.board, info);
+            }
+            // The batch of final positions
+            for (game_t& game : games) {
+                if (game.active && game.playout.evaluate) {
+                    game.score = evaluate(&game.board, &eval);
+                }
+            }
+            for (game_t& game : games) {
+                if (!game.active) continue;
+                const double reward = game.playout.evaluate ? playout_reward(game.playout, game.score)
+                                                            : game.playout.reward;
+                mast_update(&game.board, game.first, game.side, reward);
+                backprop(reward, game.leaf, info);
+                // Taking the moves back touches much less memory than copying
+                // the board
+                while (game.board.history_ply > game.root_ply) {
+                    undo_move(&game.board);
+                }
+                ++info->playouts;
+            }
+        }
+
+        for (game_t& game : games) {
+            double result;
+            if (!game.active || !play_move(game, &result)) continue;
+
+            for (const auto& [fen, side] : game.positions) {
+                file << fen << ',' << (side == WHITE ? result : 1.0 - result) << '\n';
+            }
+            positions += game.positions.size();
+            ++finished;
+            game.active = false;
+            if (started < games_no) {
+                start_game(game);
+                ++started;
+            }
+        }
+    }
+    tree = &arena;
+    info->state = ENGINE_STOPPED;
+
+    const uint64_t elapsed = MAX(now() - start, 1ULL);
+    std::cout << "info string selfplay " << finished << " games " << positions << " positions "
+              << info->playouts << " playouts " << elapsed << " ms "
+              << static_cast<uint64_t>(3'600'000.0 * finished / elapsed) << " games/hour" << std::endl;
+}
@@ -22,6 +22,19 @@ Node *insert_node_with_tree_policy(Node *root, State *s);
 double rollout(Node* node, State *s);
 
 
+/**
+ * Plays out the position of s, leaving the moves of the playout on the board,
+ * and returns the reward for the side to move in s.
+ */
+double simulate(State *s, searchinfo_t *info);
+
+
+/**
+ * Forgets what the playout policy learnt (done at the start of every search)
+ */
+void clear_playout_policy();
+
+
 /**
  * Propogate the reward information backward along the path from node_i to the
  * root, updating the utilities for all nodes on the path.
@@ -29,7 +42,29 @@ double rollout(Node* node, State *s);
 void backprop(int reward, Node* node);
 
 
+/**
+ * Replaces the memory reserved for the search tree (while not searching).
+ * Returns false if it couldn't be allocated, keeping the old size.
+ */
+bool resize_tree(size_t megabytes);
+
+
+/**
+ * Playout statistics (lengths, early stops), accumulated over searches
+ */
+void clear_playout_stats();
+void print_playout_stats();
+
+
 /**
  * The MCTS search function
  */
 void MCTS_Search(board_t* board, searchinfo_t *info);
+
+
+/**
+ * Plays games_no games of MCTS self-play, searching each move with the given
+ * number of playouts and playing up to concurrent games at once. Writes their
+ * positions to a CSV file, with the result for the side to move.
+ */
+void MCTS_selfplay(searchinfo_t *info, int games_no, int playouts, int concurrent, const std::string& path);
@@ -0,0 +1,232 @@
+#include "metrics.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <cstdio> // std::rename, std::remove
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "time.h"
+
+bool metrics_enabled = false;
+
+namespace {
+
+// Values published by the search thread, read by the exporter thread
+typedef struct published_t {
+    // Totals over all completed searches
+    std::atomic<uint64_t> nodes{0}, playouts{0}, tbhits{0};
+    // Progress of the running search
+    std::atomic<uint64_t> curr_nodes{0}, curr_playouts{0}, curr_tbhits{0};
+    std::atomic<uint64_t> tree_bytes{0};
+    std::atomic<uint64_t> searches{0};
+    std::atomic<bool> searching{false};
+    std::atomic<uint64_t> search_start{0};
+    // Time from 'go' until bestmove (ms)
+    std::atomic<uint64_t> last_search_time{0}, search_time_total{0};
+} published_t;
+
+published_t published;
+
+std::thread exporter;
+std::atomic<bool> exporter_running{false};
+
+// Counter values at the previous refresh, for computing rates
+typedef struct rates_t {
+    uint64_t time = 0;
+    uint64_t nodes = 0, playouts = 0, busy = 0;
+} rates_t;
+
+uint64_t busy_time(uint64_t t) {
+    uint64_t busy = published.search_time_total.load(std::memory_order_relaxed);
+    if (published.searching.load(std::memory_order_relaxed)) {
+        busy += t - published.search_start.load(std::memory_order_relaxed);
+    }
+    return busy;
+}
+
+void metric(std::ostringstream& out, const char *name, const char *type,
+            const char *help, double value, const char *labels = "") {
+    out << "# HELP lishex_" << name << ' ' << help << '\n'
+        << "# TYPE lishex_" << name << ' ' << type << '\n'
+        << "lishex_" << name << labels << ' ' << value << '\n';
+}
+
+// Renders the current metrics, updating the rate baseline
+std::string render(rates_t *prev) {
+    auto get = [](const std::atomic<uint64_t>& v) { return v.load(std::memory_order_relaxed); };
+    const uint64_t t = now();
+    const uint64_t nodes = get(published.nodes) + get(published.curr_nodes);
+    const uint64_t playouts = get(published.playouts) + get(published.curr_playouts);
+    const uint64_t tbhits = get(published.tbhits) + get(published.curr_tbhits);
+    const uint64_t busy = busy_time(t);
+    const double dt = MAX(t - prev->time, 1ULL) / 1000.0;
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    metric(out, "nodes_total", "counter", "Nodes searched", nodes);
+    metric(out, "playouts_total", "counter", "MCTS playouts", playouts);
+    metric(out, "tbhits_total", "counter", "Successful tablebase probes", tbhits);
+    metric(out, "searches_total", "counter", "Completed searches", get(published.searches));
+    metric(out, "nodes_per_second", "gauge", "Search speed since the last refresh",
+           (nodes - prev->nodes) / dt);
+    metric(out, "playouts_per_second", "gauge", "MCTS playouts since the last refresh",
+           (playouts - prev->playouts) / dt);
+    metric(out, "tree_nodes", "gauge", "Nodes in the current search (tree)", get(published.curr_nodes));
+    metric(out, "arena_bytes_used", "gauge", "Memory used by the MCTS tree", get(published.tree_bytes));
+    metric(out, "last_search_seconds", "gauge", "Time from go until bestmove of the last search",
+           get(published.last_search_time) / 1000.0);
+    metric(out, "search_seconds_total", "counter", "Time spent searching",
+           busy / 1000.0);
+    metric(out, "thread_utilization", "gauge", "Fraction of time the thread spent searching",
+           MIN((busy - prev->busy) / 1000.0 / dt, 1.0), "{thread=\"search\"}");
+
+    *prev = { t, nodes, playouts, busy };
+    return out.str();
+}
+
+void write_file(const std::string& path, const std::string& text) {
+    // Write & rename, so that readers never see a partial file
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::out | std::ios::trunc);
+        if (!file.is_open()) {
+            return;
+        }
+        file << text;
+    }
+    std::rename(tmp.c_str(), path.c_str());
+}
+
+void file_exporter(std::string path, int interval_ms) {
+    rates_t prev = { now() };
+    uint64_t next = now() + interval_ms;
+    while (exporter_running) {
+        if (now() >= next) {
+            write_file(path, render(&prev));
+            next += interval_ms;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(MIN(interval_ms, 50)));
+    }
+    write_file(path, render(&prev));
+}
+
+#ifndef _WIN32
+int open_socket(const std::string& path) {
+    sockaddr_un addr = {};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    path.copy(addr.sun_path, path.size());
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Answers each connection with the latest metrics (as an HTTP response)
+void socket_exporter(int fd, std::string path, int interval_ms) {
+    rates_t prev = { now() };
+    std::string text = render(&prev);
+    uint64_t next = now() + interval_ms;
+    while (exporter_running) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 50) > 0) {
+            int client = accept(fd, nullptr, nullptr);
+            if (client >= 0) {
+                char request[1024];
+                [[maybe_unused]] ssize_t ignored = read(client, request, sizeof(request));
+                std::string response = "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: " + std::to_string(text.size()) + "\r\n\r\n" + text;
+                ignored = write(client, response.data(), response.size());
+                close(client);
+            }
+        }
+        if (now() >= next) {
+            text = render(&prev);
+            next += interval_ms;
+        }
+    }
+    close(fd);
+    unlink(path.c_str());
+}
+#endif // _WIN32
+
+} // namespace
+
+
+bool metrics_start(const std::string& kind, const std::string& path, int interval_ms) {
+    metrics_stop();
+    interval_ms = MAX(interval_ms, 1);
+
+    if (kind == "file") {
+        exporter_running = true;
+        exporter = std::thread(file_exporter, path, interval_ms);
+#ifndef _WIN32
+    } else if (kind == "socket") {
+        int fd = open_socket(path);
+        if (fd < 0) {
+            return false;
+        }
+        exporter_running = true;
+        exporter = std::thread(socket_exporter, fd, path, interval_ms);
+#endif
+    } else {
+        return false;
+    }
+    metrics_enabled = true;
+    return true;
+}
+
+void metrics_stop() {
+    metrics_enabled = false;
+    exporter_running = false;
+    if (exporter.joinable()) {
+        exporter.join();
+    }
+}
+
+void metrics_search_begin(const searchinfo_t *info) {
+    if (!metrics_enabled) return;
+    published.search_start = info->start;
+    published.searching = true;
+}
+
+void metrics_search_end(const searchinfo_t *info) {
+    if (!metrics_enabled) return;
+    const uint64_t elapsed = now() - info->start;
+    published.nodes += info->nodes;
+    published.playouts += info->playouts;
+    published.tbhits += info->tbhits;
+    published.curr_nodes = published.curr_playouts = published.curr_tbhits = 0;
+    published.tree_bytes = 0;
+    published.last_search_time = elapsed;
+    published.search_time_total += elapsed;
+    published.searching = false;
+    ++published.searches;
+}
+
+void metrics_publish(const searchinfo_t *info, uint64_t tree_bytes) {
+    published.curr_nodes.store(info->nodes, std::memory_order_relaxed);
+    published.curr_playouts.store(info->playouts, std::memory_order_relaxed);
+    published.curr_tbhits.store(info->tbhits, std::memory_order_relaxed);
+    published.tree_bytes.store(tree_bytes, std::memory_order_relaxed);
+}
@@ -0,0 +1,48 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <string>
+
+#include "types.h"
+
+/* Search telemetry
+ *
+ * Optional export of engine counters and gauges in the Prometheus text format.
+ * The search thread publishes its searchinfo_t counters at the points where it
+ * already reports to the GUI (info lines) and when a search ends. A separate
+ * thread turns them into rates and periodically rewrites a file (for the node
+ * exporter's textfile collector) or serves them on a local Unix socket
+ * (curl --unix-socket <path> http://localhost/metrics). While disabled, the
+ * search only pays for one branch per publishing point.
+ */
+
+// Set while the exporter is running
+extern bool metrics_enabled;
+
+/**
+ * @brief Starts the exporter thread
+ * @param kind "file" or "socket"
+ * @param path file to rewrite or Unix socket to listen on
+ * @param interval_ms how often to refresh the metrics
+ * @return false if the target couldn't be set up
+ */
+bool metrics_start(const std::string& kind, const std::string& path, int interval_ms);
+
+// Stops the exporter thread (and removes the socket, if any)
+void metrics_stop();
+
+// Called by the search thread around each search
+void metrics_search_begin(const searchinfo_t *info);
+void metrics_search_end(const searchinfo_t *info);
+
+/**
+ * @brief Publishes the progress of the running search
+ * @param tree_bytes memory used by the search tree (0 for alpha-beta)
+ */
+void metrics_publish(const searchinfo_t *info, uint64_t tree_bytes = 0);
+
+inline void metrics_update(const searchinfo_t *info, uint64_t tree_bytes = 0) {
+    if (metrics_enabled) metrics_publish(info, tree_bytes);
+}
+
+#endif // METRICS_H_
@@ -3,6 +3,11 @@
 #include "attack.h"
 #include "types.h"
 
+#if defined(__AVX512VBMI2__) && defined(__AVX512BW__)
+#define USE_VBMI2
+#include <immintrin.h>
+#endif
+
 // @TODO: Collapse the implementation for quiet and noisy
 // move generation with templates to not do the same work twice
 // (e.g. fetching attack bitboards)
@@ -10,6 +15,52 @@
 
 namespace {
 
+/**
+ * @brief Appends a move to each of the target squares, encoded as
+ * base + to * mult: for pieces base holds the flags and the origin square
+ * (mult = 1), for pawns the origin is a fixed shift away from the target,
+ * to - shift, so base = flags << 12 - (shift << 6) and mult = 65.
+ *
+ * With AVX-512 VBMI2, the target squares are compressed into bytes and
+ * expanded into up to 32 moves at once; moves are written in the same
+ * (ascending) order as by popping the bits one at a time.
+ */
+inline void serialize(movelist_t *moves, bb_t targets, int base, int mult) {
+    assert(moves->size() + CNT(targets) <= MAX_MOVES);
+#if defined(USE_VBMI2)
+    // A piece attacks at most 27 squares, 8 for the pawn moves of each kind
+    assert(CNT(targets) <= 32);
+    const __m512i squares = _mm512_set_epi8(
+        63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, 48,
+        47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32,
+        31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16,
+        15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0);
+    // (Zero-masked extract of the low half, GCC 12 warns about the cast)
+    const __m512i to = _mm512_cvtepu8_epi16(_mm512_maskz_extracti64x4_epi64(
+        0xf, _mm512_maskz_compress_epi8(targets, squares), 0));
+    // Lanes past the last target hold garbage, the list has room for them
+    _mm512_storeu_si512(moves->moves + moves->count, _mm512_add_epi16(
+        _mm512_set1_epi16(base), _mm512_mullo_epi16(to, _mm512_set1_epi16(mult))));
+    moves->count += CNT(targets);
+#else
+    while (targets) {
+        moves->push_back(base + POPLSB(targets) * mult);
+    }
+#endif
+}
+
+// Origin and flags in the form expected by serialize()
+inline int piece_moves(square_t from, int flags) {
+    return (flags << 12) | (from << 6);
+}
+
+inline int pawn_moves(int shift, int flags) {
+    return (flags << 12) - (shift << 6);
+}
+
+constexpr int PIECE_MULT = 1;
+constexpr int PAWN_MULT = (1 << 6) + 1;
+
 /**
  * @brief Generate non-captures for the given piece type
  * @tparam PIECE_T piece type to generate moves for
@@ -35,9 +86,7 @@ void generate_quiet_moves_for(const board_t *board, movelist_t *moves) {
         // Since we're generating quiet moves, we mask out all other pieces
         attacked &= ~occupied;
 
-        while (attacked) {
-            moves->push_back(Move(from, POPLSB(attacked), QUIET));
-        }
+        serialize(moves, attacked, piece_moves(from, QUIET), PIECE_MULT);
     }
 }
 
@@ -67,9 +116,7 @@ void generate_noisy_moves_for(const board_t *board, movelist_t *moves) {
         // Since we're generating noisy moves, only consider captures
         attacked &= opp_pieces;
 
-        while (attacked) {
-            moves->push_back(Move(from, POPLSB(attacked), CAPTURE));
-        }
+        serialize(moves, attacked, piece_moves(from, CAPTURE), PIECE_MULT);
     }
 }
 
@@ -130,56 +177,41 @@ void generate_promotions(const board_t *board, movelist_t *moves) {
     }
 }
 
+// A castling move: the right it needs, the squares between the king and the
+// rook (which must be empty) and the square the king passes over
+typedef struct castle_t {
+    int right;
+    square_t from, to, passed;
+    bb_t between;
+    int flags;
+} castle_t;
+
+constexpr castle_t castles[BOTH][2] = {
+    { { BK, E8, G8, F8, 0x6000000000000000ULL, KINGCASTLE },
+      { BQ, E8, C8, D8, 0x0e00000000000000ULL, QUEENCASTLE } },
+    { { WK, E1, G1, F1, 0x60ULL, KINGCASTLE },
+      { WQ, E1, C1, D1, 0x0eULL, QUEENCASTLE } }
+};
+
+// The king may not castle out of or through check (into check is caught by
+// make_move, like for any other move)
+inline bool can_castle(const board_t *board, const castle_t& castle) {
+    const int opp = board->turn ^ 1;
+    return (board->castle_rights & castle.right) &&
+           (all_pieces(board) & castle.between) == 0 &&
+           !is_attacked(board, castle.from, opp) &&
+           !is_attacked(board, castle.passed, opp);
+}
+
 /**
  * @brief Generates castling moves for the current board state
  * @param board current board state
  * @param moves movelist to append generated moves to
  */
 void generate_castles(const board_t *board, movelist_t *moves) {
-
-    // The castling rights are encoded with 4 bits:
-    // enum { WK = 1, WQ = 2, BK = 4, BQ = 8 };
-
-    // Masks to check for obstacles between the king and the rook
-    static const bb_t WK_BB = 0x60ULL;
-    static const bb_t WQ_BB = 0x0eULL;
-    static const bb_t BK_BB = 0x6000000000000000ULL;
-    static const bb_t BQ_BB = 0x0e00000000000000ULL;
-
-    const int& me = board->turn;
-
-    const bb_t occupied = all_pieces(board);
-
-    // TODO: Collapse into a single implementation (templates?)
-    if (me == WHITE) {
-        // King side castle
-        if ((board->castle_rights & WK) &&
-            ((occupied & WK_BB) == 0) &&
-             !is_attacked(board, E1, BLACK) &&
-             !is_attacked(board, F1, BLACK)) {
-            moves->push_back(Move(E1, G1, KINGCASTLE));
-        }
-        // Queen side castle
-        if ((board->castle_rights & WQ) &&
-            ((occupied & WQ_BB) == 0) &&
-             !is_attacked(board, E1, BLACK) &&
-             !is_attacked(board, D1, BLACK)) {
-            moves->push_back(Move(E1, C1, QUEENCASTLE));
-        }
-    } else { /* BLACK's turn */
-        // King side castle
-        if ((board->castle_rights & BK) &&
-            ((occupied & BK_BB) == 0) &&
-             !is_attacked(board, E8, WHITE) &&
-             !is_attacked(board, F8, WHITE)) {
-            moves->push_back(Move(E8, G8, KINGCASTLE));
-        }
-        // Queen side castle
-        if ((board->castle_rights & BQ) &&
-            ((occupied & BQ_BB) == 0) &&
-             !is_attacked(board, E8, WHITE) &&
-             !is_attacked(board, D8, WHITE)) {
-            moves->push_back(Move(E8, C8, QUEENCASTLE));
+    for (const castle_t& castle : castles[board->turn]) {
+        if (can_castle(board, castle)) {
+            moves->push_back(Move(castle.from, castle.to, castle.flags));
         }
     }
 }
@@ -188,7 +220,6 @@ void generate_castles(const board_t *board, movelist_t *moves) {
 
 int generate_quiet(const board_t *board, movelist_t *moves) {
 
-    square_t to;
     int move_count = moves->size();
     // We collapse the implementation for both black and white
     const int& me = board->turn;
@@ -211,17 +242,8 @@ int generate_quiet(const board_t *board, movelist_t *moves) {
                                    : s_shift(pawn_pushes & RANK_TO_BB(6));
     double_pawn_pushes &= empty_squares;
 
-    while (pawn_pushes) {
-        to = POPLSB(pawn_pushes);
-        assert(square_ok(to));
-        moves->push_back(Move(to - dir, to, QUIET));
-    }
-
-    while (double_pawn_pushes) {
-        to = POPLSB(double_pawn_pushes);
-        assert(square_ok(to));
-        moves->push_back(Move(to - dir - dir, to, PAWNPUSH));
-    }
+    serialize(moves, pawn_pushes, pawn_moves(dir, QUIET), PAWN_MULT);
+    serialize(moves, double_pawn_pushes, pawn_moves(dir + dir, PAWNPUSH), PAWN_MULT);
 
     /* Non-sliding (leaping) Piece moves */
     generate_quiet_moves_for<KNIGHT>(board, moves);
@@ -241,7 +263,6 @@ int generate_quiet(const board_t *board, movelist_t *moves) {
 
 int generate_noisy(const board_t *board, movelist_t *moves) {
 
-    square_t to;
     int move_count = moves->size();
     const int& me = board->turn;
     int opp = me ^ 1;
@@ -258,20 +279,12 @@ int generate_noisy(const board_t *board, movelist_t *moves) {
     bb_t pawn_captures_east = (me) ? ne_shift(pawns_bb) : se_shift(pawns_bb);
     pawn_captures_east &= opp_pieces;
 
-    while (pawn_captures_east) {
-        to = POPLSB(pawn_captures_east);
-        assert(square_ok(to));
-        moves->push_back(Move(to - dir - EAST, to, CAPTURE));
-    }
+    serialize(moves, pawn_captures_east, pawn_moves(dir + EAST, CAPTURE), PAWN_MULT);
 
     bb_t pawn_captures_west = (me) ? nw_shift(pawns_bb) : sw_shift(pawns_bb);
     pawn_captures_west &= opp_pieces;
 
-    while (pawn_captures_west) {
-        to = POPLSB(pawn_captures_west);
-        assert(square_ok(to));
-        moves->push_back(Move(to - dir - WEST, to, CAPTURE));
-    }
+    serialize(moves, pawn_captures_west, pawn_moves(dir + WEST, CAPTURE), PAWN_MULT);
 
     /* En passant captures */
     if (board->ep_square != NO_SQ) {
@@ -310,15 +323,63 @@ int generate_moves(const board_t *board, movelist_t *moves) {
 }
 
 
-bool move_exists(const board_t *board, move_t move) {
-    movelist_t moves;
-    generate_moves(board, &moves);
-    for (const move_t m : moves) {
-        if (m == move) {
-            return true;
+bool is_pseudo_legal(const board_t *board, const move_t move) {
+    const square_t from = get_from(move);
+    const square_t to = get_to(move);
+    const int flags = get_flags(move);
+    const int me = board->turn;
+    const piece_t pce = board->pieces[from];
+
+    // A piece of the side to move, not landing on a friendly piece
+    if (from == to || pce == NO_PIECE || piece_color(pce) != me ||
+        (board->sides_pieces[me] & SQ_TO_BB(to))) {
+        return false;
+    }
+
+    const bb_t occupied = all_pieces(board);
+    const bool capture = board->sides_pieces[me ^ 1] & SQ_TO_BB(to);
+
+    if (piece_type(pce) == PAWN) {
+        const int dir = me ? NORTH : SOUTH;
+        const bb_t from_bb = SQ_TO_BB(from);
+        const bb_t captures = me ? ne_shift(from_bb) | nw_shift(from_bb)
+                                 : se_shift(from_bb) | sw_shift(from_bb);
+        // Exactly the moves of pawns about to promote are promotions
+        if (!is_promotion(move) != !(PROMOTING(me) & from_bb)) {
+            return false;
         }
+        // (The promotion type doesn't matter)
+        switch (is_promotion(move) ? flags & ~0b0011 : flags) {
+            case QUIET:
+            case KNIGHTPROMO:
+                return to == from + dir && !capture;
+            case PAWNPUSH:
+                return to == from + 2 * dir && SQUARE_RANK(from) == (me ? 1 : 6) &&
+                       !(occupied & (SQ_TO_BB(from + dir) | SQ_TO_BB(to)));
+            case CAPTURE:
+            case KNIGHTPROMO | CAPTURE:
+                return capture && (captures & SQ_TO_BB(to));
+            case EPCAPTURE:
+                return to == board->ep_square && (captures & SQ_TO_BB(to));
+            default:
+                return false;
+        }
+    }
+
+    if (flags == KINGCASTLE || flags == QUEENCASTLE) {
+        for (const castle_t& castle : castles[me]) {
+            if (castle.flags == flags) {
+                return piece_type(pce) == KING && from == castle.from &&
+                       to == castle.to && can_castle(board, castle);
+            }
+        }
+    }
+    if (flags != (capture ? CAPTURE : QUIET)) {
+        return false;
     }
-    return false;
+    const bb_t attacked = piece_type(pce) == KING ? attacks<KING>(from)
+                                                  : attacks(pce, from, occupied);
+    return attacked & SQ_TO_BB(to);
 }
 
 
@@ -46,7 +46,14 @@ int generate_moves(const board_t *board, movelist_t *moves);
  */
 uint64_t perft(board_t *board, int depth, bool verbose = false);
 
-// True if pseudolegal move exists in the current position, false otherwise
-bool move_exists(const board_t *board, move_t move);
+/**
+ * @brief Checks whether a move is one of the pseudolegal moves in the
+ * position, in constant time: the moving piece, the flags, the path and the
+ * special cases are checked directly against the bitboards. Meant for moves
+ * not coming from the move generator (e.g. parsed, or remembered from
+ * another position like killers).
+ * @return true iff generate_moves() would generate the move
+ */
+bool is_pseudo_legal(const board_t *board, const move_t move);
 
 #endif // MOVEGEN_H_
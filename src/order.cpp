@@ -3,7 +3,6 @@
 */
 #include "order.h"
 
-#include <cstring> // memmove
 #include <string>
 #include <climits> // INT_MAX
 
@@ -59,45 +58,6 @@ constexpr int MVV_LVA[PIECE_NO][PIECE_NO] = {
     {606, 605, 604, 603, 602, 601, 600, 606, 606, 605, 604, 603, 602, 601, 600}, // k
 };
 
-// Function to sort first n moves of an array of moves using insertion sort
-[[maybe_unused]] void movesort(scored_move_t moves[], int n) {
-    int i, j;
-    scored_move_t move;
-    for (i = 1; i < n; i++) {
-        move = moves[i];
-        j = i - 1;
-
-        // Move elements of arr[0..i-1],
-        // that are greater than key,
-        // to one position ahead of their
-        // current position
-        while (j >= 0 && moves[j].score < move.score) {
-            moves[j + 1] = moves[j];
-            --j;
-        }
-        moves[j + 1] = move;
-    }
-}
-
-// Basic insertion sort implementation
-inline void sort(movelist_t *moves) {
-    // TODO: Insertion sort for move scores (https://stackoverflow.com/a/52818393)
-    int swaps = 0;
-    move_t tmp;
-    for (int j = 1, n = moves->size(); j < n; ++j) {
-        tmp = moves->movelist[j];
-        swaps = 0;
-        for (int i = j-1; (i >= 0) && moves->movelist[i] > tmp; --i) {
-            ++swaps;
-        }
-        if (swaps) {
-            std::memmove(moves->movelist+j+2, moves->movelist+j+1, swaps * sizeof(move_t));
-            moves->movelist[j+1] = tmp;
-        }
-    }
-
-}
-
 } // namespace
 
 
@@ -113,31 +73,32 @@ void score_moves(const board_t *board, movelist_t *moves, move_t pv_move, move_t
     square_t from, to;
     int flags = 0;
     for (int i = 0; i < n; ++i) {
-        scored_move_t& move = moves->movelist[i];
-        assert(move_ok(move.move));
-        if (move.move == pv_move) {
-            assert(move.move == pv_move && pv_move != NULLMV);
-            move.score = PV_BONUS;
+        const move_t move = moves->moves[i];
+        int32_t& score = moves->scores[i];
+        assert(move_ok(move));
+        if (move == pv_move) {
+            assert(move == pv_move && pv_move != NULLMV);
+            score = PV_BONUS;
             continue;
         }
 
-        move.score = 0;
-        from = get_from(move.move);
-        to = get_to(move.move);
-        flags = get_flags(move.move);
+        score = 0;
+        from = get_from(move);
+        to = get_to(move);
+        flags = get_flags(move);
 
         // We search promotions before captures
         /*
         if (is_promotion(move)) {
             switch (flags & ~CAPTURE) {
                 case QUEENPROMO:
-                    move.score = GOOD_PROMO_BONUS + 1;  break;
+                    score = GOOD_PROMO_BONUS + 1;  break;
                 case KNIGHTPROMO:
-                    move.score = GOOD_PROMO_BONUS;      break;
+                    score = GOOD_PROMO_BONUS;      break;
                 case ROOKPROMO:
-                    move.score = BAD_PROMO_PENALTY + 1; break;
+                    score = BAD_PROMO_PENALTY + 1; break;
                 case BISHOPPROMO:
-                    move.score = BAD_PROMO_PENALTY;     break;
+                    score = BAD_PROMO_PENALTY;     break;
                 default:
                     break;
             }
@@ -147,37 +108,37 @@ void score_moves(const board_t *board, movelist_t *moves, move_t pv_move, move_t
 
         if (is_capture(move)) {
             // If the capture is losing, we leave its score as 0
-            move.score = CAPTURE_BONUS;
+            score = CAPTURE_BONUS;
             if (flags == EPCAPTURE)
-                move.score += MVV_LVA[PAWN][PAWN];
+                score += MVV_LVA[PAWN][PAWN];
             else
-                move.score += MVV_LVA[board->pieces[to]][board->pieces[from]];
+                score += MVV_LVA[board->pieces[to]][board->pieces[from]];
 
             continue;
         }
 
         /* Check if killer move 1 */
-        if (killer1 == move.move) {
-            move.score = KILLER1_BONUS;
+        if (killer1 == move) {
+            score = KILLER1_BONUS;
         /* Otherwise, check if killer move 2 */
-        } else if (killer2 == move.move) {
-            move.score = KILLER2_BONUS;
+        } else if (killer2 == move) {
+            score = KILLER2_BONUS;
         /* Otherwise, order according to the move history */
         } else {
-            move.score = MAX(0, 100'000 + board->history_h[board->turn][board->pieces[from]][to]);
+            score = MAX(0, 100'000 + board->history_h[board->turn][board->pieces[from]][to]);
         }
 
         /* TODO: Additional small bonuses
         switch (flags & ~CAPTURE) { // clear CAPTURE bit
             case KINGCASTLE:
             case QUEENCASTLE:
-                move.score += CASTLE_BONUS;
+                score += CASTLE_BONUS;
                 break;
             case QUEENPROMO:
             case ROOKPROMO:
             case BISHOPPROMO:
             case KNIGHTPROMO:
-                move.score += PROMO_BONUS;
+                score += PROMO_BONUS;
                 break;
             default:
                 break;
@@ -194,41 +155,24 @@ move_t next_best(movelist_t *moves, [[maybe_unused]] int ply) {
     }
 
     // Find next best move in our move list and place it at the current best move idx
-    // (single-pass linear scan)
-    size_t best_idx = moves->used;
-    int32_t best_score = 0;
-    for (size_t idx = moves->used; idx < moves->size(); ++idx) {
-        scored_move_t& move = moves->movelist[idx];
-        if (move.score > best_score) {
-            best_score = move.score;
-            best_idx = idx;
-        }
-    }
-
-    // Swap the moves
-    scored_move_t tmp = moves->movelist[moves->used];
-    moves->movelist[moves->used] = moves->movelist[best_idx];
-    moves->movelist[best_idx] = tmp;
+    moves->swap(moves->used, moves->best(moves->used));
  #ifdef DEBUG
     /*
          std::cout << std::string(2 * ply, ' ') \
-         << "Selected move " << move_to_str(moves->movelist[moves->used]) \
-         << " with score " << moves->movelist[moves->used].score \
+         << "Selected move " << move_to_str(moves->moves[moves->used]) \
+         << " with score " << moves->scores[moves->used] \
          << std::endl;
     */
  #endif
                            // Move used, hence increase the counter
-    return moves->movelist[moves->used++];
+    return moves->moves[moves->used++];
 }
 
 // Prints out the n (default = 5) best scoring moves
 void movescore(const board_t *board, movelist_t *moves, int n) {
 
-    int count = 0;
-    for (const scored_move_t move : *moves) {
-        if (count++ == n)
-            break;
+    for (int i = 0; i < MIN(n, static_cast<int>(moves->size())); ++i) {
         std::string indent(board->ply, ' ');
-        std::cout << indent << move_to_str(move) << ": " << move.score << std::endl;
+        std::cout << indent << move_to_str(moves->moves[i]) << ": " << moves->scores[i] << std::endl;
     }
 }
@@ -0,0 +1,124 @@
+#include "output.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace {
+
+// How often the writer drains the queue when not woken up
+constexpr auto WRITE_INTERVAL = std::chrono::milliseconds(10);
+
+// Queue capacity in bytes (a power of 2)
+constexpr size_t QUEUE_SIZE = 1 << 20;
+
+char queue[QUEUE_SIZE];
+// Total bytes ever queued (written by the producer) and written out (by the
+// writer), positions in the queue are taken modulo its size
+std::atomic<uint64_t> head{0}, tail{0};
+
+std::thread writer;
+std::atomic<bool> running{false};
+
+// Only used to wake the writer up early, never taken by regular info lines
+std::mutex wake_mutex;
+std::condition_variable wake;
+bool woken = false;
+
+bool push(const char *bytes, size_t n) {
+    const uint64_t h = head.load(std::memory_order_relaxed);
+    if (QUEUE_SIZE - (h - tail.load(std::memory_order_acquire)) < n) {
+        return false;
+    }
+    const size_t offset = h & (QUEUE_SIZE - 1);
+    const size_t first = MIN(n, QUEUE_SIZE - offset);
+    memcpy(queue + offset, bytes, first);
+    memcpy(queue, bytes + first, n - first);
+    head.store(h + n, std::memory_order_release);
+    return true;
+}
+
+void drain() {
+    const uint64_t h = head.load(std::memory_order_acquire);
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (t == h) {
+        return;
+    }
+    while (t < h) {
+        const size_t offset = t & (QUEUE_SIZE - 1);
+        const size_t n = MIN(h - t, QUEUE_SIZE - offset);
+        std::fwrite(queue + offset, 1, n, stdout);
+        t += n;
+    }
+    std::fflush(stdout);
+    tail.store(t, std::memory_order_release);
+}
+
+void write_loop() {
+    while (running.load(std::memory_order_relaxed)) {
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait_for(lock, WRITE_INTERVAL, [] { return woken; });
+            woken = false;
+        }
+        drain();
+    }
+    drain();
+}
+
+} // namespace
+
+
+void output_start() {
+    if (running) return;
+    // Anything written through std::cout so far goes first
+    std::cout.flush();
+    running = true;
+    writer = std::thread(write_loop);
+}
+
+void output_stop() {
+    if (!running) return;
+    running = false;
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        woken = true;
+    }
+    wake.notify_one();
+    writer.join();
+}
+
+void output(const line_t& line, bool urgent) {
+    char bytes[LINE_SIZE + 1];
+    memcpy(bytes, line.text, line.size);
+    bytes[line.size] = '\n';
+    const size_t n = line.size + 1;
+
+    if (!running.load(std::memory_order_relaxed)) {
+        std::cout.write(bytes, n).flush();
+        return;
+    }
+
+    if (!urgent) {
+        push(bytes, n);
+        return;
+    }
+
+    while (!push(bytes, n)) {
+        std::this_thread::yield();
+    }
+    const uint64_t end = head.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        woken = true;
+    }
+    wake.notify_one();
+    while (tail.load(std::memory_order_acquire) < end && running.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <string>
+#include <charconv>
+#include <type_traits>
+
+#include "types.h"
+
+/* Engine output
+ *
+ * The search thread doesn't write its info and bestmove lines to stdout
+ * itself. It appends them to a lock-free single producer, single consumer
+ * byte queue, which an I/O thread drains with one write and one flush per
+ * batch of lines. This way the search never waits on a slow pipe and doesn't
+ * pay a flush per line. A bestmove wakes the writer right away and waits until
+ * it's out, so that it's sent with minimal delay and after everything else.
+ * Without a running writer, lines go straight to stdout.
+ */
+
+// Minimum time between two periodic info lines of a search
+constexpr uint64_t INFO_INTERVAL_MS = 100;
+
+// Longest line that can be queued (longer ones get truncated)
+constexpr size_t LINE_SIZE = 2048;
+
+/**
+ * @brief A line of output, built in place without any allocations
+ */
+typedef struct line_t {
+    char text[LINE_SIZE];
+    size_t size = 0;
+
+    line_t& operator<<(const char *s) {
+        while (*s && size < LINE_SIZE) text[size++] = *s++;
+        return *this;
+    }
+
+    line_t& operator<<(const std::string& s) {
+        return *this << s.c_str();
+    }
+
+    line_t& operator<<(char c) {
+        if (size < LINE_SIZE) text[size++] = c;
+        return *this;
+    }
+
+    template<typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    line_t& operator<<(T value) {
+        size = std::to_chars(text + size, text + LINE_SIZE, value).ptr - text;
+        return *this;
+    }
+} line_t;
+
+// Starts the I/O thread
+void output_start();
+
+// Writes out whatever is queued and stops the I/O thread
+void output_stop();
+
+/**
+ * @brief Queues a line of output (a newline is added). Must only be called
+ * from one thread at a time (the search thread).
+ * @param urgent if set, returns only once the line has been written out
+ * (otherwise the line is dropped if the queue is full)
+ */
+void output(const line_t& line, bool urgent = false);
+
+#endif // OUTPUT_H_
@@ -0,0 +1,164 @@
+#include "perf.h"
+
+#include <iostream>
+#include <iomanip>
+#include <cstring> // memset
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+bool perf_enabled = false;
+perf_sample_t perf_search;
+
+namespace {
+
+constexpr const char *event_names[PERF_EVENT_NO] = {
+    "cycles", "instructions", "L1d-misses", "LLC-misses",
+    "branch-misses", "dTLB-misses", "task-clock-ns"
+};
+
+#ifdef __linux__
+
+constexpr uint64_t cache_event(uint64_t cache, uint64_t op, uint64_t result) {
+    return cache | (op << 8) | (result << 16);
+}
+
+// (type, config) pairs of the events, in the order of perf_event_id
+constexpr uint32_t event_types[PERF_EVENT_NO] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+    PERF_TYPE_SOFTWARE
+};
+
+constexpr uint64_t event_configs[PERF_EVENT_NO] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS),
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS),
+    PERF_COUNT_SW_TASK_CLOCK
+};
+
+/**
+ * @brief Counter group of a single thread. All events are read at once with
+ * a single read(2) on the group leader.
+ */
+typedef struct perf_group_t {
+    bool opened = false;
+    int leader = -1;
+    int fds[PERF_EVENT_NO];
+    // Position of each event within the group read buffer (-1 if unavailable)
+    int slot[PERF_EVENT_NO];
+    int size = 0;
+
+    void open() {
+        opened = true;
+        for (int e = 0; e < PERF_EVENT_NO; ++e) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = event_types[e];
+            attr.config = event_configs[e];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                             | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+            slot[e] = fds[e] < 0 ? -1 : size++;
+            if (leader < 0 && fds[e] >= 0) {
+                leader = fds[e];
+            }
+        }
+        if (leader >= 0) {
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    void read_values(perf_sample_t *sample) {
+        if (!opened) {
+            open();
+        }
+        // Layout: number of events, the times the group was enabled and
+        // running, followed by the values of the events
+        uint64_t buffer[PERF_EVENT_NO + 3] = {};
+        const bool ok = leader >= 0 &&
+            ::read(leader, buffer, sizeof(uint64_t) * (size + 3)) > 0;
+        const uint64_t enabled = buffer[1], running = buffer[2];
+        for (int e = 0; e < PERF_EVENT_NO; ++e) {
+            // A group that never got the counters (e.g. more events than the
+            // PMU has) counts nothing, one that shared them is scaled up
+            if (!ok || slot[e] < 0 || running == 0) {
+                sample->value[e] = UINT64_MAX;
+            } else if (running == enabled) {
+                sample->value[e] = buffer[slot[e] + 3];
+            } else {
+                sample->value[e] = static_cast<uint64_t>(
+                    static_cast<double>(buffer[slot[e] + 3]) * enabled / running);
+            }
+        }
+    }
+
+    ~perf_group_t() {
+        for (int e = 0; opened && e < PERF_EVENT_NO; ++e) {
+            if (fds[e] >= 0) {
+                close(fds[e]);
+            }
+        }
+    }
+} perf_group_t;
+
+thread_local perf_group_t group;
+
+#endif // __linux__
+
+} // namespace
+
+
+void perf_read(perf_sample_t *sample) {
+#ifdef __linux__
+    group.read_values(sample);
+#else
+    for (int e = 0; e < PERF_EVENT_NO; ++e) {
+        sample->value[e] = UINT64_MAX;
+    }
+#endif
+}
+
+void perf_print(const std::string& label, const perf_sample_t& sample) {
+    const std::ios_base::fmtflags flags = std::cout.flags();
+    const std::streamsize precision = std::cout.precision();
+    std::cout << "info string perf " << label;
+    for (int e = 0; e < PERF_EVENT_NO; ++e) {
+        std::cout << ' ' << event_names[e] << ' ';
+        if (sample.available(e)) {
+            std::cout << sample.value[e];
+        } else {
+            std::cout << "n/a";
+        }
+    }
+
+    // Derived metrics
+    const uint64_t *v = sample.value;
+    if (sample.available(PERF_CYCLES) && sample.available(PERF_INSTRUCTIONS) && v[PERF_CYCLES]) {
+        std::cout << " IPC " << std::fixed << std::setprecision(2)
+                  << static_cast<double>(v[PERF_INSTRUCTIONS]) / v[PERF_CYCLES];
+    }
+    if (sample.available(PERF_INSTRUCTIONS) && v[PERF_INSTRUCTIONS]) {
+        for (int e : {PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES}) {
+            if (sample.available(e)) {
+                std::cout << ' ' << event_names[e] << "-PKI " << std::fixed << std::setprecision(2)
+                          << 1000.0 * v[e] / v[PERF_INSTRUCTIONS];
+            }
+        }
+    }
+    std::cout << std::endl;
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
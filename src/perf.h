@@ -0,0 +1,78 @@
+#ifndef PERF_H_
+#define PERF_H_
+
+#include <string>
+
+#include "types.h"
+
+/* Hardware performance counters
+ *
+ * Thin wrapper around Linux perf_event_open(2) counting user-space events of
+ * the calling thread. Every thread lazily opens its own counter group on first
+ * use. Events the kernel or the (virtual) machine doesn't support, or which
+ * never got a hardware counter, are reported as n/a. Counts of a group that
+ * had to share the counters with others are scaled up to its enabled time. Instrumentation is off by default (see the 'perf' UCI command) and
+ * costs a single branch per measuring point when disabled.
+ */
+
+enum perf_event_id {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_TASK_CLOCK, // Software event (ns), available even without a PMU
+    PERF_EVENT_NO
+};
+
+// Counter values (or differences thereof), UINT64_MAX if not available
+typedef struct perf_sample_t {
+    uint64_t value[PERF_EVENT_NO] = {};
+
+    inline bool available(int event) const {
+        return value[event] != UINT64_MAX;
+    }
+
+    // Accumulates the counts elapsed between samples from and to
+    inline void add(const perf_sample_t& from, const perf_sample_t& to) {
+        for (int e = 0; e < PERF_EVENT_NO; ++e) {
+            value[e] = available(e) && from.available(e) && to.available(e)
+                     ? value[e] + (to.value[e] - from.value[e]) : UINT64_MAX;
+        }
+    }
+} perf_sample_t;
+
+// Set by the 'perf' UCI command
+extern bool perf_enabled;
+
+// Counts of the last completed search, written by the search thread
+extern perf_sample_t perf_search;
+
+/**
+ * @brief Reads the counters of the calling thread, opening them on first use
+ * @param sample where to store the current counter values
+ */
+void perf_read(perf_sample_t *sample);
+
+/**
+ * @brief Ends a measured section: adds the counts since *last to *total and
+ * restarts the measurement at the current values. Does nothing when
+ * instrumentation is disabled.
+ */
+inline void perf_lap(perf_sample_t *last, perf_sample_t *total) {
+    if (!perf_enabled) return;
+    perf_sample_t curr;
+    perf_read(&curr);
+    total->add(*last, curr);
+    *last = curr;
+}
+
+/**
+ * @brief Prints the counts (and derived ratios like IPC) on a single line
+ * @param label printed in front of the counts
+ * @param sample counts to be printed
+ */
+void perf_print(const std::string& label, const perf_sample_t& sample);
+
+#endif // PERF_H_
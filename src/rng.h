@@ -9,6 +9,11 @@ void seed_rng(uint64_t rng_seed = 42069ULL);
 
 uint64_t rand_uint64();
 
+// Returns a uniformly distributed double in [0, 1)
+inline double rand_double() {
+    return (rand_uint64() >> 11) * 0x1.0p-53;
+}
+
 // Assumes PRNG has been seeded (init_keys)
 // Returns a random sparse (low number of set bits) 64-bit integer
 inline uint64_t sparse_uint64() {
@@ -9,6 +9,10 @@
 #include "threads.h"
 #include "order.h"
 #include "mcts.h"
+#include "tablebase.h"
+#include "trace.h"
+#include "metrics.h"
+#include "output.h"
 
 // Global evaluation struct (for multithreaded, we'll want to have a separate one for
 // each thread)
@@ -63,9 +67,9 @@ typedef struct pv_line {
     move_t& operator[](int i)      { return moves[i]; }
 
     // Print the principal variation line
-    void print() const {
+    void print(line_t& line) const {
         for (size_t i = 0; i < size; ++i) {
-            std::cout << move_to_str(moves[i]) << " ";
+            line << move_to_str(moves[i]) << ' ';
         }
     }
 
@@ -73,6 +77,34 @@ typedef struct pv_line {
         move_t *last = moves;
 } pv_line;
 
+// Best moves of the PV lines found so far in the current iteration (MultiPV),
+// these are excluded from the search for the next line
+movelist_t excluded_moves;
+
+// PV lines of the last completed iteration and their scores (MultiPV)
+pv_line multipv_lines[MAX_MOVES];
+int multipv_scores[MAX_MOVES];
+
+// Checks if a move is to be searched at the root
+inline bool is_root_move(const searchinfo_t *info, const move_t move) {
+    return (info->searchmoves.size() == 0 || info->searchmoves.find(move) >= 0)
+        && excluded_moves.find(move) < 0;
+}
+
+// Counts the legal moves to search at the root
+int count_root_moves(board_t *board, const searchinfo_t *info) {
+    movelist_t moves;
+    generate_moves(board, &moves);
+    int count = 0;
+    for (const move_t move : moves) {
+        if (is_root_move(info, move) && make_move(board, move)) {
+            undo_move(board, move);
+            ++count;
+        }
+    }
+    return count;
+}
+
 // Global PV table (quadratic approach)
 // - indexed by [ply]
 // - pv[ply] is the principal variation line for the search at depth 'ply'
@@ -117,6 +149,23 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
         return -2 + (info->nodes & 0x3);
     }
 
+    // If we can repeat a position of the search, we can at least draw
+    if (board->ply && α < 0 && has_game_cycle(board)) {
+        α = MAX(α, -2 + static_cast<int>(info->nodes & 0x3));
+        if (α >= β) {
+            return α;
+        }
+    }
+
+    // Probe the tablebases, converting distance to mate into a mate score
+    int wdl, dtm;
+    if (board->ply && tb_probe(board, &wdl, &dtm)) {
+        ++info->tbhits;
+        if (wdl == TB_WIN)  return +oo - board->ply - dtm;
+        if (wdl == TB_LOSS) return -oo + board->ply + dtm;
+        return 0;
+    }
+
     // Are we too deep into the search tree?
     if (board->ply >= MAX_DEPTH - 1) {
         return evaluate(board, &eval);
@@ -147,6 +196,10 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
     move_t bestmove = NULLMV;
     while ((move = next_best(&moves, board->ply)) != NULLMV) {
 
+        // At the root, skip the moves excluded by searchmoves or earlier PV lines
+        if (!board->ply && !is_root_move(info, move))
+            continue;
+
         // Pseudo-legal move generation
         if (!make_move(board, move))
             continue;
@@ -203,24 +256,33 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
 }
 
 inline void print_search_info(int s, int d, int sd, uint64_t n, uint64_t t,
-                              const pv_line &pv, [[maybe_unused]] board_t *board) {
+                              uint64_t tb, const pv_line &pv, [[maybe_unused]] board_t *board,
+                              int multipv = 0) {
 
   // Print the info line
-  std::cout << "info depth " << d << " seldepth " << sd \
-            << " score ";
+  line_t line;
+  line << "info depth " << d << " seldepth " << sd;
+  if (multipv) {
+      line << " multipv " << multipv;
+  }
+  line << " score ";
 
-  // Print mate distance info if a player is being mated
-  if (std::abs(s) >= +oo - MAX_DEPTH) {
-     std::cout << "mate " \
+  // Print mate distance info if a player is being mated (tablebase mates can
+  // lie up to TB_MAX_DTM plies past the search horizon)
+  if (std::abs(s) >= +oo - MAX_DEPTH - TB_MAX_DTM) {
+     line << "mate " \
           << (s > 0 ? +oo - s + 1 : -oo - s + 1) / 2;
   } else {
-      std::cout << "cp " << s;
+      line << "cp " << s;
   }
-  std::cout << " nodes " << n << " time " << t \
-            << " pv ";
+  line << " nodes " << n << " time " << t;
+  if (tb) {
+      line << " tbhits " << tb;
+  }
+  line << " pv ";
 
-  pv.print();
-  std::cout << std::endl;
+  pv.print(line);
+  output(line);
 }
 
 
@@ -347,8 +409,11 @@ int quiescence(int α, int β, board_t *board, searchinfo_t *info, stack_t *stac
 
 /* Search the tree starting from the root node (current board state) */
 void search(board_t *board, searchinfo_t *info) {
-    alphabeta(board, info);
-    //MCTS_Search(board, info);
+    if (info->use_mcts) {
+        MCTS_Search(board, info);
+    } else {
+        alphabeta(board, info);
+    }
 }
 
 
@@ -365,6 +430,15 @@ void alphabeta(board_t *board, searchinfo_t *info) {
     int curr_depth_nodes = 0;
     int curr_depth_time = 0;
 
+    // Number of PV lines to search, at most the number of root moves. If none
+    // of the searchmoves are legal, we search all moves instead
+    excluded_moves.clear();
+    if (!count_root_moves(board, info)) {
+        info->searchmoves.clear();
+    }
+    const int pv_lines = MAX(MIN(info->multipv, count_root_moves(board, info)), 1);
+    int order[MAX_MOVES];
+
     /*
     std::cout << "Starting search: ";
     std::cout << "time allocated: " << info->end - now();
@@ -380,25 +454,53 @@ void alphabeta(board_t *board, searchinfo_t *info) {
         // For time management
         curr_depth_time = now();
 
-        stack[0].score = best_score = negamax(-oo, +oo, depth, board, info, stack);
+        // Search for each PV line in turn, excluding the best moves of the
+        // lines before it
+        trace_begin("iteration", depth);
+        excluded_moves.clear();
+        for (int i = 0; i < pv_lines; ++i) {
+            multipv_scores[i] = negamax(-oo, +oo, depth, board, info, stack);
+            if (search_stopped(info)) {
+                break;
+            }
+            multipv_lines[i] = pv_tb[0];
+            excluded_moves.push_back(pv_tb[0][0]);
+        }
+        trace_end("iteration", depth);
 
         curr_depth_nodes = info->nodes - curr_depth_nodes;
         curr_depth_time = now() - curr_depth_time;
 
         if (search_stopped(info)) {
+            trace_instant("stopped", depth);
             break;
         }
 
         assert(info->state == ENGINE_SEARCHING);
 
-        best_move = pv_tb[0][0];
-
-        print_search_info(best_score,
-                          depth,
-                          info->seldepth,
-                          info->nodes,
-                          now() - info->start,
-                          pv_tb[0], board);
+        // Lines searched later can still score higher (search instability)
+        for (int i = 0; i < pv_lines; ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order, order + pv_lines, [](int a, int b) {
+            return multipv_scores[a] > multipv_scores[b];
+        });
+
+        stack[0].score = best_score = multipv_scores[order[0]];
+        best_move = multipv_lines[order[0]][0];
+        trace_instant("info", depth);
+
+        for (int i = 0; i < pv_lines; ++i) {
+            print_search_info(multipv_scores[order[i]],
+                              depth,
+                              info->seldepth,
+                              info->nodes,
+                              now() - info->start,
+                              info->tbhits,
+                              multipv_lines[order[i]], board,
+                              pv_lines > 1 ? i + 1 : 0);
+        }
+        metrics_update(info);
 
         LOG("info string depth " << depth \
             << std::setprecision(4) \
@@ -416,7 +518,9 @@ void alphabeta(board_t *board, searchinfo_t *info) {
         //}
     }
 
-    std::cout << "bestmove " << move_to_str(best_move) << std::endl;
+    line_t line;
+    output(line << "bestmove " << move_to_str(best_move), true);
+    trace_instant("bestmove");
 
     assert(check(board));
 
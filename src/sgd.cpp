@@ -8,10 +8,15 @@
 #include <algorithm>
 #include <fstream>
 #include <sstream>
+#include <atomic>
+#include <thread>
 
 #include "board.h"
 #include "search.h"
 #include "eval.h"
+#include "movegen.h"
+#include "order.h"
+#include "time.h"
 
 double _K = 0.8649;
 // https://www.chessprogramming.org/Pawn_Advantage,_Win_Percentage,_and_Elo
@@ -45,14 +50,28 @@ constexpr bool tune_king_psqt   = 0;
 constexpr bool tune_king_safety = 0;
 constexpr bool tune_pawn_eval   = 0;
 constexpr int datapoints_no = 2'000'000;
+// Streaming input: only a validation sample of the dataset is loaded, the
+// minibatches are read from the rest of the file (see batch_stream_t)
+constexpr bool stream_dataset = 0;
+constexpr int validation_no = 200'000;
+constexpr size_t chunk_bytes = 1 << 20;
 constexpr int epochs_no = 500;
+// Optimizer for the (in-memory) dataset: Adam on minibatches, or L-BFGS on
+// the whole dataset. Streamed datasets are always tuned with Adam.
+enum { ADAM, LBFGS };
+constexpr int optimizer = LBFGS;
+constexpr int lbfgs_memory = 8;       // Corrections kept (m)
+constexpr int lbfgs_iterations = 200;
+constexpr double lbfgs_first_step = 10; // Largest change (cp) of the first step
+constexpr double armijo_c1 = 1e-4;     // Sufficient decrease
+// Fit the sigmoid's scaling constant _K to the dataset before tuning
+constexpr bool fit_K = 1;
 size_t batch_size = 262144;
 //int batch_size = 128;
 
 // Random number generator for initializing positions and velocities
 std::random_device rd;
 std::mt19937 rng(rd());
-extern eval_t eval;
 
 inline double rand_within(int lower, int upper) {
     std::uniform_real_distribution<double> unif(lower, upper);
@@ -69,32 +88,174 @@ std::vector<param_t> best_parameters;
 // Vector storing gradients
 std::vector<double> gradients;
 
-// Error squared for a single datapoint x
-double error(datapoint_t& x) {
-    board_t b[1];
-    searchinfo_t i[1];
-    stack_t s[MAX_MOVES];
+// Threads computing the MSE (and resolving positions)
+int threads = 1;
+// Positions evaluated so far, to compare optimizers
+uint64_t evaluations = 0;
+
+// Error squared for a single datapoint x (a quiet position, see
+// resolve_positions), with a scratch board and evaluation
+double error(const datapoint_t& x, board_t *b, eval_t *ev) {
     setup(b, x.fen);
-    //int score = quiescence(-oo, +oo, b, i, s);
-    int score = evaluate(b, &eval);
+    int score = evaluate(b, ev);
     return std::pow(x.result - winning_prob(score), 2);
 }
 
-// Mean square error for the batch (if no batch size specified, then for the entire dataset)
-double MSE(int batch = -1) {
-    if (batch == -1)
-        batch = positions.size();
+// Moves from a position to the quiet position its quiescence search ends in
+typedef struct {
+    move_t moves[MAX_DEPTH];
+    int size = 0;
+} variation_t;
+
+/**
+ * @brief Quiescence search as in search.cpp, which also returns its principal
+ * variation. Safe to run on several threads at once, as long as each has its
+ * own scratch evaluation.
+ * @param pv set to the moves leading to the quiet position the score is from
+ */
+int resolve(int α, int β, board_t *board, eval_t *ev, variation_t *pv) {
+    pv->size = 0;
+
+    int score = evaluate(board, ev);
+    if (board->ply >= MAX_DEPTH - 1) {
+        return score;
+    }
+    if (score >= β) {
+        return β;
+    }
+    if (score > α) {
+        α = score;
+    }
+
+    movelist_t noisy;
+    generate_noisy(board, &noisy);
+    score_moves(board, &noisy, NULLMV, nullptr);
+
+    variation_t line;
+    move_t move = NULLMV;
+    while ((move = next_best(&noisy, board->ply)) != NULLMV) {
+        if (!make_move(board, move))
+            continue;
+        score = -resolve(-β, -α, board, ev, &line);
+        undo_move(board, move);
+
+        if (score >= β) {
+            return β;
+        }
+        if (score > α) {
+            α = score;
+            pv->moves[0] = move;
+            std::copy(line.moves, line.moves + line.size, pv->moves + 1);
+            pv->size = line.size + 1;
+        }
+    }
+    return α;
+}
+
+// Replaces x by the quiet position its quiescence search ends in, returns
+// false if it was quiet already
+bool resolve_datapoint(datapoint_t& x, board_t *board, eval_t *ev) {
+    variation_t pv;
+    setup(board, x.fen);
+    resolve(-oo, +oo, board, ev, &pv);
+    if (pv.size == 0) {
+        return false;
+    }
+    for (int i = 0; i < pv.size; ++i) {
+        make_move(board, pv.moves[i]);
+    }
+    // Results are for the side to move
+    if (pv.size % 2) {
+        x.result = 1.0 - x.result;
+    }
+    x.fen = to_fen(board);
+    return true;
+}
 
+// Replaces every datapoint by the quiet position its quiescence search ends
+// in, so that the epochs (which only evaluate) don't train on the middle of
+// exchanges. Runs on all threads, with the engine's own parameters (before
+// register_parameters randomizes any). Returns how many weren't quiet.
+size_t resolve_positions(std::vector<datapoint_t>& data) {
+    assert(parameters.empty());
+    constexpr size_t CHUNK = 1 << 12;
+    std::atomic<size_t> next{0}, changed{0};
+    auto worker = [&]() {
+        board_t board[1];
+        eval_t ev;
+        size_t begin, moved = 0;
+        while ((begin = next.fetch_add(CHUNK)) < data.size()) {
+            const size_t end = MIN(begin + CHUNK, data.size());
+            for (size_t idx = begin; idx < end; ++idx) {
+                moved += resolve_datapoint(data[idx], board, &ev);
+            }
+        }
+        changed += moved;
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& th : pool) {
+        th.join();
+    }
+    return changed;
+}
+
+// Mean square error over the first n datapoints (all of them by default).
+// Each thread sums a contiguous slice, so the result doesn't depend on timing.
+double MSE(const std::vector<datapoint_t>& data, size_t n = SIZE_MAX) {
+    n = MIN(n, data.size());
+    evaluations += n;
+
+    std::vector<double> sums(threads);
+    auto worker = [&](int t) {
+        board_t b[1];
+        eval_t ev;
+        double total_error = 0;
+        for (size_t i = n * t / threads; i < n * (t + 1) / threads; ++i) {
+            total_error += error(data[i], b, &ev);
+        }
+        sums[t] = total_error;
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        pool.emplace_back(worker, t);
+    }
+    worker(0);
+    for (std::thread& th : pool) {
+        th.join();
+    }
     double total_error = 0;
-    for (int i = 0; i < batch; ++i) {
-        total_error += error(positions[i]);
+    for (double sum : sums) {
+        total_error += sum;
     }
-    return total_error / double(batch);
+    return total_error / double(n);
 }
 
 std::string dataset = "/home/mkjm/Projects/lishex/tune/dataset.csv";
 
-void load_datapoints(std::string &filename) {
+// Parses a line of the dataset CSV (FEN, result)
+bool parse_datapoint(const std::string& line, datapoint_t& x) {
+    std::string token;
+    std::istringstream iss(line);
+    std::vector<std::string> tokens;
+    while (std::getline(iss, token, ',')) {
+        tokens.push_back(token);
+    }
+
+    if (tokens.size() != 2) {
+        std::cout << "Error parsing line: " << line << std::endl;
+        return false;
+    }
+    // 1 for Won, 0.5 for Draw, 0 for Lost
+    x = {tokens[0], std::stod(tokens[1]), 0.0};
+    return !x.fen.empty();
+}
+
+// Loads up to limit positions, returns the offset in the file where it stopped
+size_t load_datapoints(std::string &filename, size_t limit) {
 
     std::fstream file(filename, std::ios::in);
 
@@ -103,39 +264,187 @@ void load_datapoints(std::string &filename) {
         exit(1);
     }
 
-    std::string line, token;
+    std::string line;
     // Skip the first line of the CSV (column names)
     std::getline(file, line);
 
     size_t count = 0;
     // For each line, parse the FEN and the corresponding eval score
-    while (std::getline(file, line)) {
+    while (count < limit && std::getline(file, line)) {
         count++;
-        if (count >= datapoints_no) break;
         std::cout << "Reading entry " << count << "\r";
         std::cout.flush();
 
-        std::istringstream iss(line);
-        std::vector<std::string> tokens;
-        while (std::getline(iss, token, ',')) {
-            tokens.push_back(token);
+        datapoint_t x;
+        if (parse_datapoint(line, x)) {
+            positions.push_back(x);
         }
+    }
+    // (past the end if the whole file was read)
+    const size_t offset = file ? static_cast<size_t>(file.tellg()) : SIZE_MAX;
+    file.close();
 
-        if (tokens.size() != 2) {
-            std::cout << "Error parsing line: " << line << std::endl;
-            continue;
-        }
-        std::string fen = tokens[0];
-        // 1 for Won, 0.5 for Draw, 0 for Lost
-        double outcome = std::stod(tokens[1]);
+    std::cout << "File '" << filename << "' opened successfully" << std::endl;
+    return offset;
+}
+
+// Loads up to limit positions of the dataset and resolves them, returns the
+// offset in the file where it stopped. Must run before register_parameters.
+size_t prepare_positions(size_t limit) {
+    const size_t offset = load_datapoints(dataset, limit);
+    const uint64_t start = now();
+    const size_t changed = resolve_positions(positions);
+    std::cout << "Resolved " << positions.size() << " positions (" << changed
+              << " not quiet) on " << threads << " threads in " << now() - start
+              << " ms" << std::endl;
+    return offset;
+}
 
-        if (!fen.empty()) {
-            positions.push_back({fen, outcome, 0.0});
+// Resolves the dataset from offset (the start of a line) on, block by block,
+// and writes it to a new CSV to be streamed: the stream itself only reads, so
+// that nothing evaluates while the optimizer changes the parameters. Must run
+// before register_parameters. Returns false if nothing was written.
+bool resolve_dataset(const std::string& filename, size_t offset, const std::string& resolved) {
+    constexpr size_t BLOCK = 1 << 16;
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    std::ofstream out(resolved, std::ios::out | std::ios::trunc);
+    if (!in.is_open() || !out.is_open()) {
+        std::cout << "Failed to resolve '" << filename << "' into '" << resolved << "'" << std::endl;
+        return false;
+    }
+    out << "fen,result\n";
+
+    const uint64_t start = now();
+    size_t total = 0, changed = 0;
+    std::vector<datapoint_t> block;
+    std::string line;
+    in.seekg(offset);
+    while (in) {
+        block.clear();
+        while (block.size() < BLOCK && std::getline(in, line)) {
+            datapoint_t x;
+            if (parse_datapoint(line, x)) {
+                block.push_back(std::move(x));
+            }
+        }
+        changed += resolve_positions(block);
+        for (const datapoint_t& x : block) {
+            out << x.fen << "," << x.result << "\n";
         }
+        total += block.size();
+        std::cout << "Resolved " << total << " positions to stream\r";
+        std::cout.flush();
     }
-    file.close();
+    std::cout << "Resolved " << total << " positions to stream (" << changed
+              << " not quiet) into '" << resolved << "' in " << now() - start
+              << " ms" << std::endl;
+    if (total == 0) {
+        std::cout << "Nothing to stream from '" << filename << "'" << std::endl;
+        return false;
+    }
+    return static_cast<bool>(out.flush());
+}
 
-    std::cout << "File '" << filename << "' opened successfully" << std::endl;
+/**
+ * @brief Minibatches streamed from a dataset too large to be loaded. The file
+ * is split into chunks of chunk_bytes, read in a random order (reshuffled on
+ * every pass over the file), and the positions of consecutive chunks are
+ * shuffled together into batches. A prefetch thread reads and decodes the
+ * next batch while the optimizer works on the current one. The file must be
+ * resolved already (see resolve_dataset): the prefetcher never evaluates.
+ */
+typedef struct batch_stream_t {
+    // Streams the file from offset (the start of a line) on
+    bool open(const std::string& filename, size_t offset);
+    // Waits for the prefetched batch and starts prefetching the next one. The
+    // batch stays valid until the next call.
+    batch_t& next();
+    ~batch_stream_t();
+
+private:
+    void fill(batch_t& batch);
+    void read_chunk();
+
+    std::ifstream file;
+    size_t file_size = 0;
+    // Offsets of the chunks, in the order they're read in
+    std::vector<size_t> chunks;
+    size_t next_chunk = 0;
+    // Positions read but not handed out yet
+    std::vector<datapoint_t> pool;
+    std::mt19937 gen{rd()};
+    // The current batch and the one being prefetched
+    batch_t buffers[2];
+    int current = 0;
+    std::thread prefetcher;
+} batch_stream_t;
+
+bool batch_stream_t::open(const std::string& filename, size_t offset) {
+    file.open(filename, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Failed to open file '" << filename << "'" << std::endl;
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    file_size = file.tellg();
+    for (size_t chunk = offset; chunk < file_size; chunk += chunk_bytes) {
+        chunks.push_back(chunk);
+    }
+    if (chunks.empty()) {
+        std::cout << "Nothing to stream from '" << filename << "'" << std::endl;
+        return false;
+    }
+    std::shuffle(chunks.begin(), chunks.end(), gen);
+    prefetcher = std::thread(&batch_stream_t::fill, this, std::ref(buffers[current ^ 1]));
+    return true;
+}
+
+batch_t& batch_stream_t::next() {
+    prefetcher.join();
+    current ^= 1;
+    prefetcher = std::thread(&batch_stream_t::fill, this, std::ref(buffers[current ^ 1]));
+    return buffers[current];
+}
+
+batch_stream_t::~batch_stream_t() {
+    if (prefetcher.joinable()) {
+        prefetcher.join();
+    }
+}
+
+void batch_stream_t::fill(batch_t& batch) {
+    while (pool.size() < batch_size) {
+        read_chunk();
+    }
+    std::shuffle(pool.begin(), pool.end(), gen);
+    batch.datapoints.assign(std::make_move_iterator(pool.end() - batch_size),
+                            std::make_move_iterator(pool.end()));
+    pool.resize(pool.size() - batch_size);
+}
+
+void batch_stream_t::read_chunk() {
+    // Another pass over the file
+    if (next_chunk == chunks.size()) {
+        std::shuffle(chunks.begin(), chunks.end(), gen);
+        next_chunk = 0;
+    }
+    const size_t begin = chunks[next_chunk++];
+    const size_t end = MIN(begin + chunk_bytes, file_size);
+
+    // The chunk starts with the first line starting in it: skip what's left
+    // of the line before (or the column names)
+    std::string line;
+    file.clear();
+    file.seekg(begin ? begin - 1 : 0);
+    std::getline(file, line);
+    size_t position = file.tellg();
+    while (position < end && std::getline(file, line)) {
+        position += line.size() + 1;
+        datapoint_t x;
+        if (parse_datapoint(line, x)) {
+            pool.push_back(std::move(x));
+        }
+    }
 }
 
 void register_parameters() {
@@ -242,22 +551,26 @@ void print_parameters(std::vector<param_t>& params) {
 
 
 // Numerically estimates the gradient of L (the MSE)
-void estimate_gradient(const double old_L, const int batch, const int delta = 1) {
+// over the first n datapoints of the batch
+void estimate_gradient(const double old_L, std::vector<datapoint_t>& batch, size_t n, const int delta = 1) {
     for (size_t i = 0; i < parameters.size(); ++i) {
         // Vary the parameter value by delta
         *parameters[i].value += delta;
         // Estimate the gradient
-        gradients[i] = MSE(batch) - old_L;
+        gradients[i] = MSE(batch, n) - old_L;
         // Restore the parameter's value
         *parameters[i].value -= delta;
     }
 }
 
 // Adam: Adaptive Moment Estimation variant of SGD (https://arxiv.org/abs/1412.6980)
-void adam() {
+// The batches are drawn from the loaded positions, or from stream if given
+// (the loaded positions then being the validation sample)
+void adam(batch_stream_t *stream = nullptr) {
+    const char *held_out = stream ? "the validation sample" : "the entire dataset";
     double alpha = initial_a, L_t, eta, delta, L_t1;
-    double best_mse = MSE();
-    std::cout << "Best MSE over the entire dataset: " << best_mse << std::endl;
+    double best_mse = MSE(positions);
+    std::cout << "Best MSE over " << held_out << ": " << best_mse << std::endl;
     int tmp;
 
     // See: https://en.wikipedia.org/wiki/Stochastic_gradient_descent#Adam
@@ -267,10 +580,15 @@ void adam() {
     for (int epoch = 1; epoch < epochs_no; ++epoch) {
         std::cout << "Epoch " << epoch << std::endl;
 
-        std::shuffle(positions.begin(), positions.end(), rng);
+        std::vector<datapoint_t> *batch = &positions;
+        if (stream) {
+            batch = &stream->next().datapoints;
+        } else {
+            std::shuffle(positions.begin(), positions.end(), rng);
+        }
 
-        L_t = MSE(batch_size);
-        estimate_gradient(L_t, batch_size);
+        L_t = MSE(*batch, batch_size);
+        estimate_gradient(L_t, *batch, batch_size);
 
         // For each dimension (individual parameter)
         for (size_t i = 0; i < parameters.size(); ++i) {
@@ -292,13 +610,14 @@ void adam() {
             }
         }
 
-        L_t1 = MSE(batch_size);
+        L_t1 = MSE(*batch, batch_size);
         std::cout << "Batch MSE before the step: " << L_t
-                  << ", after the step: " << L_t1 << std::endl;
+                  << ", after the step: " << L_t1
+                  << " (" << evaluations << " positions evaluated)" << std::endl;
 
         if (epoch % 10 == 0) {
-            L_t1 = MSE();
-            std::cout << "New MSE over the entire dataset: " << L_t1 << std::endl;
+            L_t1 = MSE(positions);
+            std::cout << "New MSE over " << held_out << ": " << L_t1 << std::endl;
             if (L_t1 > best_mse) {
                 alpha /= 2.0;
                 std::cout << "Decreasing learning rate to " << alpha << std::endl;
@@ -317,16 +636,190 @@ void adam() {
     }
 }
 
+// Fits _K to the dataset for the current parameters, by a golden-section
+// search (the MSE being unimodal in K)
+void fit_sigmoid() {
+    const double ratio = (std::sqrt(5.0) - 1.0) / 2.0;
+    double lo = 0.1, hi = 3.0;
+    double k1 = hi - ratio * (hi - lo), k2 = lo + ratio * (hi - lo);
+    _K = k1;
+    double L1 = MSE(positions);
+    _K = k2;
+    double L2 = MSE(positions);
+    while (hi - lo > 1e-4) {
+        if (L1 < L2) {
+            hi = k2;
+            k2 = k1, L2 = L1;
+            k1 = hi - ratio * (hi - lo);
+            _K = k1;
+            L1 = MSE(positions);
+        } else {
+            lo = k1;
+            k1 = k2, L1 = L2;
+            k2 = lo + ratio * (hi - lo);
+            _K = k2;
+            L2 = MSE(positions);
+        }
+    }
+    _K = (lo + hi) / 2.0;
+    std::cout << "Fitted K = " << _K << ", MSE " << MSE(positions) << std::endl;
+}
+
+// Sets the parameters to x (rounded)
+void set_parameters(const std::vector<double>& x) {
+    for (size_t i = 0; i < parameters.size(); ++i) {
+        *parameters[i].value = static_cast<int>(std::lround(x[i]));
+    }
+}
+
+double dot(const std::vector<double>& a, const std::vector<double>& b) {
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// L-BFGS (https://en.wikipedia.org/wiki/Limited-memory_BFGS) over the whole
+// dataset, with a backtracking (Armijo) line search. Parameters are integers,
+// so the iterates are rounded, and the search ends once no step changes them
+// for the better.
+void lbfgs() {
+    const size_t n = parameters.size();
+    const uint64_t start = now();
+    std::vector<double> x(n), g(n), d(n), x_new(n);
+    for (size_t i = 0; i < n; ++i) {
+        x[i] = *parameters[i].value;
+    }
+    // Corrections s = x_new - x and y = g_new - g of the last iterations
+    std::vector<std::vector<double>> S, Y;
+    std::vector<double> rho, a(lbfgs_memory);
+
+    double L = MSE(positions);
+    estimate_gradient(L, positions, positions.size());
+    g = gradients;
+    std::cout << "Iteration 0: MSE " << L << std::endl;
+
+    for (int iteration = 1; iteration <= lbfgs_iterations; ++iteration) {
+        // Two-loop recursion: d = -H g
+        d = g;
+        for (int j = S.size() - 1; j >= 0; --j) {
+            a[j] = rho[j] * dot(S[j], d);
+            for (size_t i = 0; i < n; ++i) d[i] -= a[j] * Y[j][i];
+        }
+        double step = 1.0;
+        if (S.empty()) {
+            double largest = 0;
+            for (size_t i = 0; i < n; ++i) largest = std::max(largest, std::abs(d[i]));
+            step = largest > 0 ? lbfgs_first_step / largest : 0;
+        } else {
+            const double gamma = dot(S.back(), Y.back()) / dot(Y.back(), Y.back());
+            for (size_t i = 0; i < n; ++i) d[i] *= gamma;
+        }
+        for (size_t j = 0; j < S.size(); ++j) {
+            const double b = rho[j] * dot(Y[j], d);
+            for (size_t i = 0; i < n; ++i) d[i] += (a[j] - b) * S[j][i];
+        }
+        for (size_t i = 0; i < n; ++i) d[i] = -d[i];
+        double slope = dot(g, d);
+        if (slope >= 0) {
+            // Not a descent direction: start over from steepest descent
+            S.clear(), Y.clear(), rho.clear();
+            d = g;
+            double largest = 0;
+            for (size_t i = 0; i < n; ++i) d[i] = -d[i], largest = std::max(largest, std::abs(d[i]));
+            step = largest > 0 ? lbfgs_first_step / largest : 0;
+            slope = dot(g, d);
+        }
+
+        // Backtracking, until the MSE decreases enough or the step is too
+        // small to change any (rounded) parameter
+        double L_new = L;
+        bool moved = false;
+        while (true) {
+            double largest = 0;
+            for (size_t i = 0; i < n; ++i) {
+                x_new[i] = std::round(x[i] + step * d[i]);
+                largest = std::max(largest, std::abs(x_new[i] - x[i]));
+            }
+            if (largest == 0) break;
+            set_parameters(x_new);
+            L_new = MSE(positions);
+            if (L_new <= L + armijo_c1 * step * slope) {
+                moved = true;
+                break;
+            }
+            step /= 2;
+        }
+        if (!moved) {
+            set_parameters(x);
+            std::cout << "[Converged] no step improves the MSE" << std::endl;
+            break;
+        }
+
+        const std::vector<double> g_old = g;
+        estimate_gradient(L_new, positions, positions.size());
+        g = gradients;
+        std::vector<double> s(n), y(n);
+        for (size_t i = 0; i < n; ++i) {
+            s[i] = x_new[i] - x[i];
+            y[i] = g[i] - g_old[i];
+        }
+        // Keep the correction only if it preserves a positive definite H
+        const double sy = dot(s, y);
+        if (sy > 1e-12) {
+            if (S.size() == static_cast<size_t>(lbfgs_memory)) {
+                S.erase(S.begin()), Y.erase(Y.begin()), rho.erase(rho.begin());
+            }
+            S.push_back(s), Y.push_back(y), rho.push_back(1.0 / sy);
+        }
+
+        std::cout << "Iteration " << iteration << ": MSE " << L_new
+                  << " (" << L_new - L << "), step " << step
+                  << ", " << evaluations << " positions evaluated, "
+                  << now() - start << " ms" << std::endl;
+        x = x_new;
+        L = L_new;
+    }
+    best_parameters = parameters;
+}
+
 } // namespace
 
 void tune() {
     /*init*/
-    register_parameters();
-    gradients.resize(parameters.size());
-    load_datapoints(dataset);
-    batch_size = MIN(batch_size, positions.size());
-
-    adam();
+    threads = MAX(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+    // Positions are resolved, and K fitted, with the engine's own parameters
+    // (before register_parameters randomizes any)
+    if constexpr (stream_dataset) {
+        // The validation sample comes first, the batches from the rest, which
+        // is resolved once into its own file
+        const size_t offset = prepare_positions(validation_no);
+        const std::string resolved = dataset + ".resolved";
+        if (!resolve_dataset(dataset, offset, resolved)) {
+            exit(1);
+        }
+        if constexpr (fit_K) fit_sigmoid();
+        register_parameters();
+        gradients.resize(parameters.size());
+        batch_stream_t stream;
+        if (!stream.open(resolved, 0)) {
+            exit(1);
+        }
+        adam(&stream);
+    } else {
+        prepare_positions(datapoints_no);
+        if constexpr (fit_K) fit_sigmoid();
+        register_parameters();
+        gradients.resize(parameters.size());
+        batch_size = MIN(batch_size, positions.size());
+        if constexpr (optimizer == LBFGS) {
+            lbfgs();
+        } else {
+            adam();
+        }
+    }
 
     print_parameters(best_parameters);
 }
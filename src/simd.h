@@ -0,0 +1,147 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include "types.h"
+#include "bitboard.h"
+
+/* Bitboard vectors
+ *
+ * A vec_t holds VEC_LANES bitboards: 8 with AVX-512, 4 with AVX2 and a single
+ * one otherwise, so that code written against these helpers has a scalar
+ * fallback for free. The instruction set is picked at compile time (see the
+ * simd option in the Makefile).
+ */
+
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+#define USE_AVX512
+#include <immintrin.h>
+typedef __m512i vec_t;
+constexpr int VEC_LANES = 8;
+#elif defined(__AVX2__)
+#define USE_AVX2
+#include <immintrin.h>
+typedef __m256i vec_t;
+constexpr int VEC_LANES = 4;
+#else
+typedef bb_t vec_t;
+constexpr int VEC_LANES = 1;
+#endif
+
+#if defined(USE_AVX512)
+
+// The zero-masked forms of the intrinsics avoid GCC 12's false
+// -Wmaybe-uninitialized warnings about the unmasked ones
+
+inline vec_t vec_set1(const uint64_t x) { return _mm512_set1_epi64(x); }
+inline vec_t vec_load(const uint64_t *p) { return _mm512_load_si512(p); }
+inline void vec_store(uint64_t *p, const vec_t v) { _mm512_store_si512(p, v); }
+inline vec_t vec_and(const vec_t a, const vec_t b) { return _mm512_and_si512(a, b); }
+inline vec_t vec_or(const vec_t a, const vec_t b) { return _mm512_or_si512(a, b); }
+inline vec_t vec_add(const vec_t a, const vec_t b) { return _mm512_add_epi64(a, b); }
+inline vec_t vec_sub(const vec_t a, const vec_t b) { return _mm512_sub_epi64(a, b); }
+// ~a & b
+inline vec_t vec_andnot(const vec_t a, const vec_t b) { return _mm512_maskz_andnot_epi64(0xff, a, b); }
+// All bits set in the lanes where a > b (signed)
+inline vec_t vec_gt(const vec_t a, const vec_t b) {
+    return _mm512_maskz_set1_epi64(_mm512_cmpgt_epi64_mask(a, b), -1);
+}
+inline vec_t vec_sllv(const vec_t a, const vec_t n) { return _mm512_maskz_sllv_epi64(0xff, a, n); }
+inline vec_t vec_popcnt(const vec_t a) { return _mm512_popcnt_epi64(a); }
+// Signed product of the lower 32 bits of each lane
+inline vec_t vec_mul32(const vec_t a, const vec_t b) { return _mm512_maskz_mul_epi32(0xff, a, b); }
+inline int64_t vec_hsum(const vec_t a) {
+    const __m256i sum4 = _mm256_add_epi64(_mm512_maskz_extracti64x4_epi64(0xf, a, 0),
+                                          _mm512_maskz_extracti64x4_epi64(0xf, a, 1));
+    const __m128i sum2 = _mm_add_epi64(_mm256_castsi256_si128(sum4), _mm256_extracti128_si256(sum4, 1));
+    return _mm_cvtsi128_si64(sum2) + _mm_extract_epi64(sum2, 1);
+}
+
+template<int N>
+inline vec_t vec_shift(const vec_t a) {
+    if constexpr (N >= 0) return _mm512_maskz_slli_epi64(0xff, a, N);
+    else                  return _mm512_maskz_srli_epi64(0xff, a, -N);
+}
+
+#elif defined(USE_AVX2)
+
+inline vec_t vec_set1(const uint64_t x) { return _mm256_set1_epi64x(x); }
+inline vec_t vec_load(const uint64_t *p) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(p)); }
+inline void vec_store(uint64_t *p, const vec_t v) { _mm256_store_si256(reinterpret_cast<__m256i*>(p), v); }
+inline vec_t vec_and(const vec_t a, const vec_t b) { return _mm256_and_si256(a, b); }
+inline vec_t vec_or(const vec_t a, const vec_t b) { return _mm256_or_si256(a, b); }
+inline vec_t vec_add(const vec_t a, const vec_t b) { return _mm256_add_epi64(a, b); }
+inline vec_t vec_sub(const vec_t a, const vec_t b) { return _mm256_sub_epi64(a, b); }
+inline vec_t vec_andnot(const vec_t a, const vec_t b) { return _mm256_andnot_si256(a, b); }
+inline vec_t vec_gt(const vec_t a, const vec_t b) { return _mm256_cmpgt_epi64(a, b); }
+inline vec_t vec_sllv(const vec_t a, const vec_t n) { return _mm256_sllv_epi64(a, n); }
+inline vec_t vec_mul32(const vec_t a, const vec_t b) { return _mm256_mul_epi32(a, b); }
+
+// No native 64-bit popcount: nibble lookups, summed per lane (Mula et al.)
+inline vec_t vec_popcnt(const vec_t a) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(a, low_mask));
+    const __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(a, 4), low_mask));
+    return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+inline int64_t vec_hsum(const vec_t a) {
+    const __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+    return _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1);
+}
+
+template<int N>
+inline vec_t vec_shift(const vec_t a) {
+    if constexpr (N >= 0) return _mm256_slli_epi64(a, N);
+    else                  return _mm256_srli_epi64(a, -N);
+}
+
+#else
+
+inline vec_t vec_set1(const uint64_t x) { return x; }
+inline vec_t vec_load(const uint64_t *p) { return *p; }
+inline void vec_store(uint64_t *p, const vec_t v) { *p = v; }
+inline vec_t vec_and(const vec_t a, const vec_t b) { return a & b; }
+inline vec_t vec_or(const vec_t a, const vec_t b) { return a | b; }
+inline vec_t vec_add(const vec_t a, const vec_t b) { return a + b; }
+inline vec_t vec_sub(const vec_t a, const vec_t b) { return a - b; }
+inline vec_t vec_andnot(const vec_t a, const vec_t b) { return ~a & b; }
+inline vec_t vec_gt(const vec_t a, const vec_t b) {
+    return static_cast<int64_t>(a) > static_cast<int64_t>(b) ? ~0ULL : 0ULL;
+}
+inline vec_t vec_sllv(const vec_t a, const vec_t n) { return a << n; }
+inline vec_t vec_popcnt(const vec_t a) { return CNT(a); }
+inline vec_t vec_mul32(const vec_t a, const vec_t b) {
+    return static_cast<int64_t>(static_cast<int32_t>(a)) * static_cast<int32_t>(b);
+}
+inline int64_t vec_hsum(const vec_t a) { return a; }
+
+template<int N>
+inline vec_t vec_shift(const vec_t a) {
+    if constexpr (N >= 0) return a << N;
+    else                  return a >> -N;
+}
+
+#endif
+
+/**
+ * @brief Kogge-Stone occluded fill: attacks of the sliders in gen along the
+ * direction given by the shift N, in each lane
+ * @param gen bitboards of the sliders
+ * @param empty bitboards of the empty squares
+ * @param edge squares which can be entered when moving in the direction
+ * (excludes wrapping around the board from the H to the A file and vice versa)
+ */
+template<int N>
+inline vec_t vec_slide(vec_t gen, vec_t empty, const vec_t edge) {
+    empty = vec_and(empty, edge);
+    gen   = vec_or(gen, vec_and(empty, vec_shift<N>(gen)));
+    empty = vec_and(empty, vec_shift<N>(empty));
+    gen   = vec_or(gen, vec_and(empty, vec_shift<2*N>(gen)));
+    empty = vec_and(empty, vec_shift<2*N>(empty));
+    gen   = vec_or(gen, vec_and(empty, vec_shift<4*N>(gen)));
+    return vec_and(vec_shift<N>(gen), edge);
+}
+
+#endif // SIMD_H_
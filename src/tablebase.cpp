@@ -0,0 +1,771 @@
+/* Retrograde generation and probing of local endgame tablebases */
+#include "tablebase.h"
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <cstring> // memset, memcmp
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "attack.h"
+#include "movegen.h"
+#include "time.h"
+
+int tb_largest = 0;
+
+namespace {
+
+/* Table entries (one byte per position, from the side to move's POV)
+ *   0      draw (during generation: not resolved yet)
+ *   255    illegal position or unused index
+ *   c      otherwise, the position is decided in (c - 1) plies: odd plies
+ *          (even c) mean the side to move mates, even plies (odd c) mean the
+ *          side to move gets mated
+ */
+constexpr uint8_t TB_UNKNOWN = 0;
+constexpr uint8_t TB_ILLEGAL = 255;
+
+inline uint8_t dtm_code(const int plies) { return static_cast<uint8_t>(plies + 1); }
+inline int code_dtm(const uint8_t code) { return code - 1; }
+inline bool code_win(const uint8_t code) { return code != TB_UNKNOWN && !(code & 1); }
+inline bool code_loss(const uint8_t code) { return code != TB_ILLEGAL && (code & 1); }
+
+// Entries are read and written concurrently by the generator threads
+inline uint8_t load(const uint8_t *entry) {
+    return __atomic_load_n(entry, __ATOMIC_RELAXED);
+}
+
+inline void store(uint8_t *entry, uint8_t value) {
+    __atomic_store_n(entry, value, __ATOMIC_RELAXED);
+}
+
+/* File format: a 64 byte header followed by the entries */
+constexpr char TB_MAGIC[8] = "LSHXTB1";
+constexpr const char *TB_SUFFIX = ".ltb";
+
+typedef struct tb_header_t {
+    char magic[8];
+    uint32_t piece_no;
+    uint32_t reserved;
+    int32_t layout[8];
+    uint64_t size;
+    uint64_t checksum;
+} tb_header_t;
+
+static_assert(sizeof(tb_header_t) == 64, "Tablebase header must be 64 bytes");
+
+/* Indexing
+ *
+ * The pieces of a table are laid out in slots: white king, black king, the
+ * remaining white pieces and then the remaining black pieces, with identical
+ * pieces in adjacent slots. A position is indexed as
+ *     ((stm * king squares + white king) * 64 + square of slot 1) * 64 + ...
+ * The white king is restricted to the a1-d1-d4 triangle (10 squares) in
+ * pawnless tables and to files a-d (32 squares) otherwise, by mirroring the
+ * board. Identical pieces are stored in ascending square order.
+ */
+constexpr square_t triangle_sq[10] = { A1, B1, C1, D1, B2, C2, D2, C3, D3, D4 };
+
+constexpr int TRIANGLE_NO = 10;
+constexpr int HALF_BOARD_NO = 32;
+
+// Upper bound for the number of tables (3 and 4 piece configurations)
+constexpr int TABLES_NO = 64;
+
+typedef struct tb_table_t {
+    std::string name;
+    // Material key of the table and of its colour-flipped counterpart
+    uint64_t key = 0ULL;
+    uint64_t flipped_key = 0ULL;
+    int piece_no = 0;
+    piece_t layout[TB_MAX_PIECES] = {};
+    bool pawns = false;
+    uint64_t size = 0;
+    uint8_t *data = nullptr;
+    // Memory-mapped file (when loaded from disk) or owned buffer (when generated)
+    void *map = nullptr;
+    size_t map_size = 0;
+    std::vector<uint8_t> owned;
+
+    int king_squares() const { return pawns ? HALF_BOARD_NO : TRIANGLE_NO; }
+} tb_table_t;
+
+tb_table_t tables[TABLES_NO];
+int tables_no = 0;
+
+int triangle_idx[SQUARE_NO];
+
+// Packs the piece counts into a key, 4 bits per piece (see pieces[] in types.h)
+// If flip is set, the colours of the pieces are swapped
+uint64_t material_key(const board_t *board, bool flip) {
+    uint64_t key = 0ULL;
+    for (piece_t pc : pieces) {
+        bb_t bb = board->bitboards[flip ? flip_colour(pc) : pc];
+        key |= static_cast<uint64_t>(CNT(bb)) << (4 * pc);
+    }
+    return key;
+}
+
+/**
+ * @brief Registers a table given by its name (e.g. "KQvKR"), without any data
+ * @param name table name, white pieces first
+ */
+tb_table_t *register_table(const std::string& name) {
+    assert(tables_no < TABLES_NO);
+    tb_table_t& tb = tables[tables_no++];
+    tb = tb_table_t();
+    tb.name = name;
+
+    // White & black kings always come first
+    tb.layout[tb.piece_no++] = K;
+    tb.layout[tb.piece_no++] = k;
+    int colour = WHITE;
+    for (size_t i = 1; i < name.size(); ++i) {
+        if (name[i] == 'v') {
+            colour = BLACK;
+            ++i; // skip the black king
+            continue;
+        }
+        piece_t pc = set_colour(piece_type(char_to_piece[name[i]]), colour);
+        tb.layout[tb.piece_no++] = pc;
+        tb.pawns |= piece_type(pc) == PAWN;
+    }
+
+    for (int i = 0; i < tb.piece_no; ++i) {
+        tb.key         += 1ULL << (4 * tb.layout[i]);
+        tb.flipped_key += 1ULL << (4 * flip_colour(tb.layout[i]));
+    }
+
+    tb.size = 2ULL * tb.king_squares();
+    for (int i = 1; i < tb.piece_no; ++i) {
+        tb.size *= SQUARE_NO;
+    }
+    return &tb;
+}
+
+// Lists all material configurations with up to TB_MAX_PIECES pieces, ordered
+// such that every table only depends on previously listed tables (captures
+// lead to fewer pieces, promotions lead to fewer pawns)
+std::vector<std::string> material_list() {
+    const std::string order = "QRBNP"; // strongest first
+    std::vector<std::string> names[TB_MAX_PIECES + 1][TB_MAX_PIECES + 1];
+
+    for (char x : order) {
+        names[3][x == 'P'].push_back(std::string("K") + x + "vK");
+    }
+
+    if constexpr (TB_MAX_PIECES >= 4) {
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (size_t j = i; j < order.size(); ++j) {
+                char x = order[i], y = order[j];
+                int pawns_no = (x == 'P') + (y == 'P');
+                names[4][pawns_no].push_back(std::string("K") + x + y + "vK");
+                names[4][pawns_no].push_back(std::string("K") + x + "vK" + y);
+            }
+        }
+    }
+
+    std::vector<std::string> list;
+    for (int n = 3; n <= TB_MAX_PIECES; ++n) {
+        for (int pawns_no = 0; pawns_no <= TB_MAX_PIECES; ++pawns_no) {
+            list.insert(list.end(), names[n][pawns_no].begin(), names[n][pawns_no].end());
+        }
+    }
+    return list;
+}
+
+tb_table_t *find_table(const board_t *board, bool *flip) {
+    uint64_t key = material_key(board, false);
+    for (int i = 0; i < tables_no; ++i) {
+        if (tables[i].data != nullptr && tables[i].key == key) {
+            *flip = false;
+            return &tables[i];
+        }
+    }
+    // The table might be stored with the colours swapped
+    for (int i = 0; i < tables_no; ++i) {
+        if (tables[i].data != nullptr && tables[i].flipped_key == key) {
+            *flip = true;
+            return &tables[i];
+        }
+    }
+    return nullptr;
+}
+
+/* Symmetries of the board */
+
+inline square_t flip_file(square_t sq) { return sq ^ 7; }
+inline square_t flip_rank(square_t sq) { return sq ^ 56; }
+inline square_t flip_diag(square_t sq) { return ((sq & 7) << 3) | (sq >> 3); }
+
+// Applies the symmetry g (bit 0: mirror files, bit 1: mirror ranks,
+// bit 2: flip along the a1-h8 diagonal) to all squares
+inline void transform(square_t *sqs, int n, int g) {
+    for (int i = 0; i < n; ++i) {
+        if (g & 1) sqs[i] = flip_file(sqs[i]);
+        if (g & 2) sqs[i] = flip_rank(sqs[i]);
+        if (g & 4) sqs[i] = flip_diag(sqs[i]);
+    }
+}
+
+// Collects the squares of the pieces in slot order. If flip is set, the board
+// is seen from the other side (colours swapped, ranks mirrored)
+void gather(const tb_table_t& tb, const board_t *board, bool flip,
+            square_t *sqs, int *stm) {
+    for (int i = 0; i < tb.piece_no; ) {
+        piece_t pc = tb.layout[i];
+        bb_t bb = board->bitboards[flip ? flip_colour(pc) : pc];
+        while (bb) {
+            square_t sq = POPLSB(bb);
+            sqs[i++] = flip ? flip_rank(sq) : sq;
+        }
+    }
+    *stm = flip ? board->turn ^ 1 : board->turn;
+}
+
+// Maps the squares onto the canonical index (sqs gets modified)
+uint64_t index_of(const tb_table_t& tb, square_t *sqs, int stm) {
+    int n = tb.piece_no;
+
+    // Move the white king onto the canonical part of the board
+    if (SQUARE_FILE(sqs[0]) > D_FILE) transform(sqs, n, 1);
+    if (!tb.pawns) {
+        if (SQUARE_RANK(sqs[0]) > RANK_4) transform(sqs, n, 2);
+        if (SQUARE_RANK(sqs[0]) > SQUARE_FILE(sqs[0])) transform(sqs, n, 4);
+    }
+
+    // Identical pieces are kept in ascending order
+    for (int i = 2; i < n; ++i) {
+        for (int j = i; j > 1 && tb.layout[j] == tb.layout[j-1] && sqs[j] < sqs[j-1]; --j) {
+            std::swap(sqs[j], sqs[j-1]);
+        }
+    }
+
+    uint64_t idx = stm;
+    idx = idx * tb.king_squares() + (tb.pawns
+        ? SQUARE_RANK(sqs[0]) * 4 + SQUARE_FILE(sqs[0])
+        : triangle_idx[sqs[0]]);
+    for (int i = 1; i < n; ++i) {
+        idx = idx * SQUARE_NO + sqs[i];
+    }
+    return idx;
+}
+
+inline uint64_t encode(const tb_table_t& tb, const board_t *board, bool flip) {
+    square_t sqs[TB_MAX_PIECES];
+    int stm;
+    gather(tb, board, flip, sqs, &stm);
+    return index_of(tb, sqs, stm);
+}
+
+// Inverse of index_of(); returns false for indices not representing a valid
+// placement of the pieces
+bool decode(const tb_table_t& tb, uint64_t idx, square_t *sqs, int *stm) {
+    int n = tb.piece_no;
+    for (int i = n - 1; i >= 1; --i) {
+        sqs[i] = idx % SQUARE_NO;
+        idx /= SQUARE_NO;
+    }
+    int king = idx % tb.king_squares();
+    *stm = idx / tb.king_squares();
+    sqs[0] = tb.pawns ? (king / 4) * 8 + king % 4 : triangle_sq[king];
+
+    bb_t occupied = 0ULL;
+    for (int i = 0; i < n; ++i) {
+        if (GETBIT(occupied, sqs[i])) return false;
+        SETBIT(occupied, sqs[i]);
+        if (i > 1 && tb.layout[i] == tb.layout[i-1] && sqs[i] < sqs[i-1]) return false;
+        if (piece_type(tb.layout[i]) == PAWN &&
+            (SQUARE_RANK(sqs[i]) == RANK_1 || SQUARE_RANK(sqs[i]) == RANK_8)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sets up a bare position (no castling, no en passant) from the given squares
+void set_board(board_t *board, const tb_table_t& tb, const square_t *sqs, int stm) {
+    memset(board->bitboards, 0, sizeof(board->bitboards));
+    memset(board->pieces, 0, sizeof(board->pieces));
+    board->sides_pieces[WHITE] = board->sides_pieces[BLACK] = 0ULL;
+    for (int i = 0; i < tb.piece_no; ++i) {
+        SETBIT(board->bitboards[tb.layout[i]], sqs[i]);
+        SETBIT(board->sides_pieces[piece_color(tb.layout[i])], sqs[i]);
+        board->pieces[sqs[i]] = tb.layout[i];
+    }
+    board->turn = stm;
+    board->castle_rights = 0;
+    board->ep_square = NO_SQ;
+    board->fifty_move = 0;
+    board->ply = board->history_ply = 0;
+    board->key = generate_pos_key(board);
+}
+
+// Looks up the entry of a position with a different material configuration
+// (reached by a capture or promotion) in the registered tables
+uint8_t exit_code(const board_t *board) {
+    if (CNT(all_pieces(board)) == 2) {
+        return TB_UNKNOWN; // bare kings
+    }
+    bool flip;
+    tb_table_t *tb = find_table(board, &flip);
+    if (tb == nullptr) {
+        std::cout << "Missing tablebase for " << to_fen(board) << std::endl;
+        exit(1);
+    }
+    return load(&tb->data[encode(*tb, board, flip)]);
+}
+
+// Looks up the entry of the position after a move (from the mover's opponent's
+// POV), the position being in table tb unless the move changed the material
+inline uint8_t child_code(const tb_table_t& tb, const board_t *board, move_t move) {
+    if (is_capture(move) || is_promotion(move)) {
+        return exit_code(board);
+    }
+    return load(&tb.data[encode(tb, board, false)]);
+}
+
+/**
+ * @brief Runs f(board, idx) for each index in [0, n) on the given number of
+ * threads, each with its own scratch board
+ */
+template<typename F>
+void parallel_for(uint64_t n, int threads, F f) {
+    constexpr uint64_t CHUNK = 1 << 14;
+    std::atomic<uint64_t> next{0};
+    auto worker = [&]() {
+        board_t board[1];
+        uint64_t begin;
+        while ((begin = next.fetch_add(CHUNK)) < n) {
+            uint64_t end = MIN(begin + CHUNK, n);
+            for (uint64_t idx = begin; idx < end; ++idx) {
+                f(board, idx);
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& th : pool) {
+        th.join();
+    }
+}
+
+/**
+ * @brief Calls f(board) for all legal positions preceding the current one by a
+ * non-capturing, non-promoting move (i.e. within the same table)
+ */
+template<typename F>
+void for_each_predecessor(board_t *board, F f) {
+    const int me = board->turn ^ 1; // side that made the last move
+    const int dir = me == WHITE ? NORTH : SOUTH;
+    const bb_t occupied = all_pieces(board);
+
+    bb_t mine = board->sides_pieces[me];
+    while (mine) {
+        square_t to = POPLSB(mine);
+        piece_t pc = board->pieces[to];
+
+        bb_t froms = 0ULL;
+        if (piece_type(pc) == PAWN) {
+            // Single & double pawn pushes (a pawn can't come from its first rank)
+            if (SQUARE_RANK_FOR(me, to) >= RANK_3 && !GETBIT(occupied, to - dir)) {
+                SETBIT(froms, to - dir);
+                if (SQUARE_RANK_FOR(me, to) == RANK_4 && !GETBIT(occupied, to - 2 * dir)) {
+                    SETBIT(froms, to - 2 * dir);
+                }
+            }
+        } else if (piece_type(pc) == KING) {
+            froms = attacks<KING>(to) & ~occupied;
+        } else {
+            froms = attacks(pc, to, occupied) & ~occupied;
+        }
+
+        while (froms) {
+            square_t from = POPLSB(froms);
+
+            // Take the move back
+            CLRBIT(board->bitboards[pc], to);    SETBIT(board->bitboards[pc], from);
+            CLRBIT(board->sides_pieces[me], to); SETBIT(board->sides_pieces[me], from);
+            board->pieces[to] = NO_PIECE;        board->pieces[from] = pc;
+            board->turn = me;
+            board->key = generate_pos_key(board);
+
+            // The side not to move can't be in check
+            if (!is_in_check(board, me ^ 1)) {
+                f(board);
+            }
+
+            // ...and replay it
+            CLRBIT(board->bitboards[pc], from);    SETBIT(board->bitboards[pc], to);
+            CLRBIT(board->sides_pieces[me], from); SETBIT(board->sides_pieces[me], to);
+            board->pieces[from] = NO_PIECE;        board->pieces[to] = pc;
+            board->turn = me ^ 1;
+            board->key = generate_pos_key(board);
+        }
+    }
+}
+
+/**
+ * @brief Generates the table via retrograde analysis. All tables it depends
+ * on need to be registered already
+ *
+ * 1) Every position is classified once by looking at its moves: mates,
+ *    stalemates and the best outcome reachable through captures and
+ *    promotions into (already solved) smaller tables.
+ * 2) For each distance d = 1, 2, ... all positions decided in d - 1 plies are
+ *    taken back one move. Predecessors of lost positions are won in d plies,
+ *    predecessors of won positions are lost once all their moves are known to
+ *    lose, which is verified by looking up their children.
+ * Whatever remains unresolved in the end is a draw.
+ */
+void generate(tb_table_t& tb, int threads) {
+    tb.owned.assign(tb.size, TB_UNKNOWN);
+    tb.data = tb.owned.data();
+
+    // Distance (plies) at which a position wins through a capture/promotion,
+    // unless it's found to win quicker within the table
+    std::vector<uint8_t> pending(tb.size, 0);
+    // Positions to verify for a loss in the current iteration
+    std::vector<uint8_t> marked(tb.size, 0);
+    uint8_t *data = tb.data;
+
+    // Largest distance assigned or pending so far
+    std::atomic<int> horizon{0};
+    auto extend_horizon = [&](int d) {
+        int h = horizon.load(std::memory_order_relaxed);
+        while (d > h && !horizon.compare_exchange_weak(h, d)) {}
+    };
+
+    /* 1) Classification */
+    parallel_for(tb.size, threads, [&](board_t *board, uint64_t idx) {
+        square_t sqs[TB_MAX_PIECES];
+        int stm;
+        if (!decode(tb, idx, sqs, &stm)) {
+            store(&data[idx], TB_ILLEGAL);
+            return;
+        }
+        set_board(board, tb, sqs, stm);
+        if (is_in_check(board, stm ^ 1)) {
+            store(&data[idx], TB_ILLEGAL);
+            return;
+        }
+
+        movelist_t moves;
+        generate_moves(board, &moves);
+
+        int legal = 0, in_table = 0;
+        int fastest_win = TB_MAX_DTM + 1, slowest_loss = -1;
+        bool escapes = false; // a capture/promotion that doesn't lose
+        for (const move_t move : moves) {
+            if (!make_move(board, move)) continue;
+            ++legal;
+            if (is_capture(move) || is_promotion(move)) {
+                uint8_t code = exit_code(board);
+                if (code_loss(code)) {
+                    fastest_win = MIN(fastest_win, code_dtm(code) + 1);
+                } else if (code_win(code)) {
+                    slowest_loss = MAX(slowest_loss, code_dtm(code) + 1);
+                } else {
+                    escapes = true;
+                }
+            } else {
+                ++in_table;
+            }
+            undo_move(board, move);
+        }
+
+        if (!legal) {
+            // Checkmate or stalemate
+            if (is_in_check(board, stm)) {
+                store(&data[idx], dtm_code(0));
+                extend_horizon(dtm_code(0));
+            }
+        } else if (fastest_win <= TB_MAX_DTM) {
+            pending[idx] = fastest_win;
+            extend_horizon(fastest_win);
+        } else if (!in_table && !escapes) {
+            // Every move leaves the table and loses
+            store(&data[idx], dtm_code(slowest_loss));
+            extend_horizon(dtm_code(slowest_loss));
+        }
+    });
+
+    // Marks all positions equivalent (by symmetry) to the given one
+    const int symmetries = tb.pawns ? 2 : 8;
+    auto for_each_image = [&](const board_t *board, auto g) {
+        square_t sqs[TB_MAX_PIECES], tmp[TB_MAX_PIECES];
+        int stm;
+        gather(tb, board, false, sqs, &stm);
+        for (int s = 0; s < symmetries; ++s) {
+            std::copy(sqs, sqs + tb.piece_no, tmp);
+            transform(tmp, tb.piece_no, s);
+            g(index_of(tb, tmp, stm));
+        }
+    };
+
+    /* 2) Retrograde iterations */
+    for (int d = 1; d <= MIN(horizon.load(), TB_MAX_DTM); ++d) {
+        const bool wins = (d & 1); // positions decided in d plies are wins
+
+        // Take back the moves leading to positions decided in d - 1 plies
+        parallel_for(tb.size, threads, [&](board_t *board, uint64_t idx) {
+            if (load(&data[idx]) != dtm_code(d - 1)) return;
+            square_t sqs[TB_MAX_PIECES];
+            int stm;
+            decode(tb, idx, sqs, &stm);
+            set_board(board, tb, sqs, stm);
+            for_each_predecessor(board, [&](const board_t *prev) {
+                for_each_image(prev, [&](uint64_t prev_idx) {
+                    if (wins) {
+                        uint8_t unknown = TB_UNKNOWN;
+                        if (__atomic_compare_exchange_n(&data[prev_idx], &unknown, dtm_code(d),
+                                false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                            extend_horizon(dtm_code(d));
+                        }
+                    } else {
+                        store(&marked[prev_idx], 1);
+                    }
+                });
+            });
+        });
+
+        // Resolve pending wins and verify the marked losses
+        parallel_for(tb.size, threads, [&](board_t *board, uint64_t idx) {
+            bool was_marked = marked[idx];
+            marked[idx] = 0;
+            if (load(&data[idx]) != TB_UNKNOWN) return;
+
+            if (wins) {
+                if (pending[idx] == d) {
+                    store(&data[idx], dtm_code(d));
+                    extend_horizon(dtm_code(d));
+                }
+                return;
+            }
+            if (!was_marked) return;
+
+            square_t sqs[TB_MAX_PIECES];
+            int stm;
+            decode(tb, idx, sqs, &stm);
+            set_board(board, tb, sqs, stm);
+
+            movelist_t moves;
+            generate_moves(board, &moves);
+            int slowest_loss = -1;
+            for (const move_t move : moves) {
+                if (!make_move(board, move)) continue;
+                uint8_t code = child_code(tb, board, move);
+                undo_move(board, move);
+                if (!code_win(code)) return; // can still escape
+                slowest_loss = MAX(slowest_loss, code_dtm(code) + 1);
+            }
+            if (slowest_loss >= 0) {
+                store(&data[idx], dtm_code(slowest_loss));
+                extend_horizon(dtm_code(slowest_loss));
+            }
+        });
+    }
+}
+
+// Simple checksum to detect truncated or corrupted files
+uint64_t checksum(const uint8_t *data, uint64_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+    for (uint64_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+bool write_table(const tb_table_t& tb, const std::string& filename) {
+    tb_header_t header = {};
+    memcpy(header.magic, TB_MAGIC, sizeof(header.magic));
+    header.piece_no = tb.piece_no;
+    for (int i = 0; i < tb.piece_no; ++i) {
+        header.layout[i] = tb.layout[i];
+    }
+    header.size = tb.size;
+    header.checksum = checksum(tb.data, tb.size);
+
+    std::ofstream file(filename, std::ios::out | std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(tb.data), tb.size);
+    return file.good();
+}
+
+bool load_table(tb_table_t& tb, const std::string& filename) {
+    tb_header_t header;
+    {
+        std::ifstream file(filename, std::ios::in | std::ios::binary);
+        if (!file.is_open() ||
+            !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            return false;
+        }
+        if (memcmp(header.magic, TB_MAGIC, sizeof(header.magic)) != 0 ||
+            header.piece_no != static_cast<uint32_t>(tb.piece_no) ||
+            header.size != tb.size) {
+            std::cout << "info string Invalid tablebase file '" << filename << "'" << std::endl;
+            return false;
+        }
+        for (int i = 0; i < tb.piece_no; ++i) {
+            if (header.layout[i] != tb.layout[i]) return false;
+        }
+    #ifdef _WIN32
+        tb.owned.resize(tb.size);
+        if (!file.read(reinterpret_cast<char*>(tb.owned.data()), tb.size)) {
+            return false;
+        }
+        tb.data = tb.owned.data();
+    #endif
+    }
+
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) != sizeof(header) + tb.size) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    tb.map = map;
+    tb.map_size = st.st_size;
+    tb.data = static_cast<uint8_t*>(map) + sizeof(header);
+#endif
+    return true;
+}
+
+void init_triangle() {
+    for (square_t sq = A1; sq <= H8; ++sq) {
+        triangle_idx[sq] = -1;
+    }
+    for (int i = 0; i < TRIANGLE_NO; ++i) {
+        triangle_idx[triangle_sq[i]] = i;
+    }
+}
+
+} // namespace
+
+
+void tb_free() {
+    for (int i = 0; i < tables_no; ++i) {
+#ifndef _WIN32
+        if (tables[i].map != nullptr) {
+            munmap(tables[i].map, tables[i].map_size);
+        }
+#endif
+        tables[i] = tb_table_t();
+    }
+    tables_no = 0;
+    tb_largest = 0;
+}
+
+void tb_generate(const std::string& path, int threads) {
+    tb_free();
+    init_triangle();
+#ifdef DEBUG
+    // Reference boards kept by make_move() aren't thread-safe
+    threads = 1;
+#endif
+    threads = MAX(threads, 1);
+
+    std::cout << "TABLE     POSITIONS        WINS      LOSSES  LONGEST  TIME (ms)" << std::endl;
+    std::cout << std::string(63, '-') << std::endl;
+    uint64_t total_start = now();
+    for (const std::string& name : material_list()) {
+        tb_table_t *tb = register_table(name);
+        uint64_t start = now();
+        generate(*tb, threads);
+
+        uint64_t legal = 0, wins = 0, losses = 0;
+        int longest = 0;
+        for (uint64_t idx = 0; idx < tb->size; ++idx) {
+            uint8_t code = tb->data[idx];
+            if (code == TB_ILLEGAL) continue;
+            ++legal;
+            if (code_win(code))  ++wins;
+            if (code_loss(code)) ++losses;
+            if (code != TB_UNKNOWN) longest = MAX(longest, code_dtm(code));
+        }
+        tb_largest = MAX(tb_largest, tb->piece_no);
+
+        std::cout << std::left << std::setw(6) << name << std::right
+                  << std::setw(12) << legal
+                  << std::setw(12) << wins
+                  << std::setw(12) << losses
+                  << std::setw(9) << longest
+                  << std::setw(11) << now() - start << std::endl;
+
+        std::string filename = path + "/" + name + TB_SUFFIX;
+        if (!write_table(*tb, filename)) {
+            std::cout << "Failed to write '" << filename << "'" << std::endl;
+        }
+    }
+    std::cout << "Tablebases generated in " << now() - total_start << " ms" << std::endl;
+}
+
+int tb_init(const std::string& path) {
+    tb_free();
+    init_triangle();
+
+    int loaded = 0;
+    for (const std::string& name : material_list()) {
+        tb_table_t *tb = register_table(name);
+        if (load_table(*tb, path + "/" + name + TB_SUFFIX)) {
+            tb_largest = MAX(tb_largest, tb->piece_no);
+            ++loaded;
+        } else {
+            tb->data = nullptr;
+        }
+    }
+    std::cout << "info string Loaded " << loaded << " tablebases from '" << path << "'" << std::endl;
+    return loaded;
+}
+
+bool tb_probe(const board_t *board, int *wdl, int *dtm) {
+    if (!tb_largest || board->castle_rights || board->ep_square != NO_SQ) {
+        return false;
+    }
+
+    int piece_no = CNT(all_pieces(board));
+    if (piece_no > tb_largest) {
+        return false;
+    }
+
+    uint8_t code = TB_UNKNOWN;
+    if (piece_no > 2) {
+        bool flip;
+        tb_table_t *tb = find_table(board, &flip);
+        if (tb == nullptr) {
+            return false;
+        }
+        code = tb->data[encode(*tb, board, flip)];
+        if (code == TB_ILLEGAL) {
+            return false;
+        }
+    }
+
+    *wdl = code_win(code) ? TB_WIN : code_loss(code) ? TB_LOSS : TB_DRAW;
+    if (dtm != nullptr) {
+        *dtm = code == TB_UNKNOWN ? 0 : code_dtm(code);
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef TABLEBASE_H_
+#define TABLEBASE_H_
+
+#include <string>
+
+#include "types.h"
+#include "board.h"
+#include "bitboard.h"
+
+/* Local endgame tablebases
+ *
+ * Distance-to-mate (DTM) tables for all material configurations with up to
+ * TB_MAX_PIECES pieces (kings included), generated by retrograde analysis on
+ * top of our own move generator. Each table is stored as a flat array with one
+ * byte per position, preceded by a small header, so that it can be
+ * memory-mapped directly.
+ *
+ * The tables ignore castling rights, en passant and the fifty move rule, so
+ * positions with castling rights or an en passant square are never probed.
+ */
+
+// Largest number of pieces (kings included) covered by the local tablebases
+constexpr int TB_MAX_PIECES = 4;
+
+// Longest distance to mate (in plies) a table can store
+constexpr int TB_MAX_DTM = 253;
+
+// Outcome of a tablebase probe, from the side to move's point of view
+enum { TB_LOSS = -1, TB_DRAW = 0, TB_WIN = 1 };
+
+// Largest piece count covered by the loaded tables (0 if none are loaded)
+extern int tb_largest;
+
+/**
+ * @brief Generates the tables for all material configurations with up to
+ * TB_MAX_PIECES pieces and writes them to the given directory. Generated tables
+ * are registered for probing right away.
+ * @param path directory to write the tables to (must exist)
+ * @param threads number of worker threads
+ */
+void tb_generate(const std::string& path, int threads);
+
+/**
+ * @brief Memory-maps all tables found in the given directory
+ * @param path directory containing the generated tables
+ * @return number of tables loaded
+ */
+int tb_init(const std::string& path);
+
+// Unmaps all loaded tables
+void tb_free();
+
+/**
+ * @brief Probes the tablebases for the given position
+ * @param board position to probe
+ * @param wdl outcome for the side to move (TB_WIN, TB_DRAW or TB_LOSS)
+ * @param dtm distance to mate in plies, if not null (0 for draws)
+ * @return true if the position is covered by a loaded table, false otherwise
+ */
+bool tb_probe(const board_t *board, int *wdl, int *dtm);
+
+#endif // TABLEBASE_H_
@@ -3,16 +3,35 @@
 
 #include "eval.h" // eval_t
 #include "mcts.h"
+#include "perf.h"
+#include "trace.h"
+#include "alloc.h"
+#include "metrics.h"
 
 // Engine loop never writes to the state variable, only reads
 void engine_loop(board_t *board, searchinfo_t *info) {
     LOG("Search thread started!");
+    trace_thread_name("search");
     while (true) {
         switch (info->state) {
             case ENGINE_SEARCHING:
                 LOG("Searching...");
+                trace_begin("search");
+                alloc_search = alloc_stats();
+                metrics_search_begin(info);
                 // Inside of search() every CHECKUP_INTERVAL nodes check engine status
-                search(board, info);
+                if (perf_enabled) {
+                    perf_sample_t start;
+                    perf_search = perf_sample_t();
+                    perf_read(&start);
+                    search(board, info);
+                    perf_lap(&start, &perf_search);
+                } else {
+                    search(board, info);
+                }
+                alloc_search = alloc_stats() - alloc_search;
+                metrics_search_end(info);
+                trace_end("search");
                 break;
             case ENGINE_PONDERING: /* @TODO: Implement pondering */
                 LOG("Pondering not implemented...");
@@ -10,6 +10,7 @@
 #include "board.h"
 #include "search.h"
 #include "time.h" // now()
+#include "trace.h"
 
 enum { ENGINE_STOPPED, ENGINE_SEARCHING, ENGINE_PONDERING, ENGINE_QUIT };
 
@@ -28,7 +29,8 @@ inline bool checkup_needed(const searchinfo_t *info) {
 
 // Checks if the search was stopped
 inline bool search_stopped(const searchinfo_t *info) {
-    return info->state != ENGINE_SEARCHING || (info->time_set && now() >= info->end);
+    return info->state != ENGINE_SEARCHING || (info->time_set && now() >= info->end)
+        || (info->node_limit && info->nodes >= info->node_limit);
 }
 
 /**
@@ -51,6 +53,7 @@ inline void search_start(std::thread &search_thread, board_t *board,
                          searchinfo_t *info) {
   info->state = ENGINE_SEARCHING;
   LOG("Starting search");
+  trace_instant("go");
   search_thread = std::thread(engine_loop, board, info);
 }
 
@@ -65,7 +68,10 @@ inline void search_stop(std::thread &search_thread, searchinfo_t *info) {
     }
 
     LOG("Blocking until thread stops the search...");
+    // The span of the join shows the stop latency
+    trace_begin("stop");
     search_thread.join();
+    trace_end("stop");
     LOG("Done!");
 }
 
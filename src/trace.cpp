@@ -0,0 +1,149 @@
+#include "trace.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+bool trace_enabled = false;
+
+namespace {
+
+typedef struct trace_record_t {
+    uint64_t ts; // ns since trace_start()
+    const char *name;
+    int64_t arg;
+    char phase;
+} trace_record_t;
+
+/**
+ * @brief Ring buffer of a single thread. Buffers of finished threads are
+ * handed out again to new ones, so each buffer corresponds to a lane in the
+ * timeline rather than to a particular std::thread.
+ */
+typedef struct trace_buffer_t {
+    int tid;
+    const char *thread_name = "thread";
+    // Total number of events written (the ring holds the last ones)
+    uint64_t written = 0;
+    bool in_use = false;
+    std::vector<trace_record_t> records;
+} trace_buffer_t;
+
+std::mutex buffers_mutex;
+std::vector<trace_buffer_t*> buffers;
+
+std::chrono::steady_clock::time_point trace_epoch;
+std::string trace_filename;
+
+trace_buffer_t *acquire_buffer() {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    for (trace_buffer_t *buffer : buffers) {
+        if (!buffer->in_use) {
+            buffer->in_use = true;
+            return buffer;
+        }
+    }
+    trace_buffer_t *buffer = new trace_buffer_t();
+    buffer->tid = buffers.size() + 1;
+    buffer->in_use = true;
+    buffer->records.resize(TRACE_BUFFER_SIZE);
+    buffers.push_back(buffer);
+    return buffer;
+}
+
+// Returns the thread's buffer to the pool once the thread exits
+typedef struct buffer_handle_t {
+    trace_buffer_t *buffer = nullptr;
+
+    trace_buffer_t *get() {
+        if (buffer == nullptr) {
+            buffer = acquire_buffer();
+        }
+        return buffer;
+    }
+
+    ~buffer_handle_t() {
+        if (buffer != nullptr) {
+            std::lock_guard<std::mutex> lock(buffers_mutex);
+            buffer->in_use = false;
+        }
+    }
+} buffer_handle_t;
+
+thread_local buffer_handle_t handle;
+
+void write_record(std::ofstream& file, const trace_buffer_t *buffer,
+                  const trace_record_t& record, bool *first) {
+    file << (*first ? "\n" : ",\n");
+    *first = false;
+    file << "{\"name\":\"" << record.name << "\",\"ph\":\"" << record.phase
+         << "\",\"ts\":" << record.ts / 1000 << '.' << std::setw(3) << std::setfill('0')
+         << record.ts % 1000 << std::setfill(' ')
+         << ",\"pid\":1,\"tid\":" << buffer->tid;
+    if (record.phase == 'i') {
+        file << ",\"s\":\"t\"";
+    }
+    file << ",\"args\":{\"value\":" << record.arg << "}}";
+}
+
+} // namespace
+
+
+void trace_event(const char *name, char phase, int64_t arg) {
+    trace_buffer_t *buffer = handle.get();
+    uint64_t ts = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - trace_epoch).count();
+    buffer->records[buffer->written++ & (TRACE_BUFFER_SIZE - 1)] = { ts, name, arg, phase };
+}
+
+void trace_thread_name(const char *name) {
+    if (trace_enabled) {
+        handle.get()->thread_name = name;
+    }
+}
+
+void trace_start(const std::string& filename) {
+    static_assert((TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1)) == 0,
+                  "Trace buffer size must be a power of 2");
+    trace_filename = filename;
+    trace_epoch = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        for (trace_buffer_t *buffer : buffers) {
+            buffer->written = 0;
+        }
+    }
+    trace_enabled = true;
+    trace_thread_name("uci");
+}
+
+void trace_dump() {
+    std::ofstream file(trace_filename);
+    if (!file.is_open()) {
+        std::cout << "info string Cannot write trace to '" << trace_filename << "'" << std::endl;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    uint64_t events = 0;
+    bool first = true;
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (const trace_buffer_t *buffer : buffers) {
+        file << (first ? "\n" : ",\n");
+        first = false;
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+             << ",\"args\":{\"name\":\"" << buffer->thread_name << ' ' << buffer->tid << "\"}}";
+
+        // Oldest events first
+        uint64_t begin = buffer->written > TRACE_BUFFER_SIZE ? buffer->written - TRACE_BUFFER_SIZE : 0;
+        for (uint64_t i = begin; i < buffer->written; ++i) {
+            write_record(file, buffer, buffer->records[i & (TRACE_BUFFER_SIZE - 1)], &first);
+        }
+        events += buffer->written - begin;
+    }
+    file << "\n]}" << std::endl;
+    std::cout << "info string Wrote " << events << " trace events to '" << trace_filename << "'" << std::endl;
+}
@@ -0,0 +1,59 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <string>
+
+#include "types.h"
+
+/* Search event timeline
+ *
+ * Optional recorder of timestamped events (iterations, playout batches, stop
+ * signals, info output, ...). Every thread appends to its own fixed-size ring
+ * buffer without any locking, overwriting its oldest events once full. The
+ * buffers are written out in the Chrome trace-event format on exit, which
+ * opens in chrome://tracing or https://ui.perfetto.dev
+ */
+
+// Events kept per thread (older ones get overwritten)
+constexpr int TRACE_BUFFER_SIZE = 1 << 16;
+
+// Set by the 'trace' UCI command
+extern bool trace_enabled;
+
+/**
+ * @brief Appends an event to the calling thread's buffer
+ * @param name event name (must be a string literal or otherwise outlive the trace)
+ * @param phase 'B' (begin), 'E' (end) or 'i' (instant), as in the trace format
+ * @param arg optional argument shown with the event
+ */
+void trace_event(const char *name, char phase, int64_t arg = 0);
+
+inline void trace_begin(const char *name, int64_t arg = 0) {
+    if (trace_enabled) trace_event(name, 'B', arg);
+}
+
+inline void trace_end(const char *name, int64_t arg = 0) {
+    if (trace_enabled) trace_event(name, 'E', arg);
+}
+
+inline void trace_instant(const char *name, int64_t arg = 0) {
+    if (trace_enabled) trace_event(name, 'i', arg);
+}
+
+/**
+ * @brief Names the calling thread's lane in the timeline
+ */
+void trace_thread_name(const char *name);
+
+/**
+ * @brief Starts recording, the trace is written to the given file on exit
+ */
+void trace_start(const std::string& filename);
+
+/**
+ * @brief Writes all recorded events to the file given to trace_start(). Must
+ * not be called while other threads are still recording.
+ */
+void trace_dump();
+
+#endif // TRACE_H_
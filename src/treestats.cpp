@@ -0,0 +1,71 @@
+#include "treestats.h"
+
+#include <cstdio>
+
+bool treestats_enabled = false;
+uint64_t treestats_interval = 0;
+
+namespace {
+
+// Records are collected here and written out in blocks, the file itself is
+// unbuffered so that the search never allocates
+constexpr size_t BLOCK_RECORDS = 4096;
+tree_record_t block[BLOCK_RECORDS];
+size_t block_size = 0;
+
+FILE *file = nullptr;
+uint32_t records = 0;
+uint32_t snapshot = 0;
+
+void write_block() {
+    if (block_size) {
+        std::fwrite(block, sizeof(tree_record_t), block_size, file);
+        block_size = 0;
+    }
+}
+
+} // namespace
+
+
+bool treestats_start(const std::string& path, int interval_ms) {
+    treestats_stop();
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::setvbuf(file, nullptr, _IONBF, 0);
+    records = snapshot = 0;
+    treestats_interval = MAX(interval_ms, 0);
+    treestats_enabled = true;
+    return true;
+}
+
+void treestats_stop() {
+    if (file == nullptr) return;
+    treestats_enabled = false;
+    write_block();
+    std::fclose(file);
+    file = nullptr;
+}
+
+uint32_t treestats_write(const tree_record_t& record) {
+    block[block_size++] = record;
+    if (block_size == BLOCK_RECORDS) {
+        write_block();
+    }
+    return records++;
+}
+
+uint32_t treestats_next_index() {
+    return records;
+}
+
+void treestats_end_snapshot() {
+    write_block();
+    std::fflush(file);
+    ++snapshot;
+}
+
+uint32_t treestats_snapshot() {
+    return snapshot;
+}
@@ -0,0 +1,72 @@
+#ifndef TREESTATS_H_
+#define TREESTATS_H_
+
+#include <string>
+
+#include "types.h"
+
+/* MCTS tree export
+ *
+ * Optional dump of the search tree to a binary file, for offline analysis.
+ * Every snapshot (taken periodically and at the end of each search) appends
+ * one record per node in pre-order, the root first. Records have a fixed size
+ * and no padding, and the file has no header, so it can be mapped directly:
+ *
+ *   dtype = np.dtype([('key', '<u8'), ('reward', '<f8'), ('parent', '<u4'),
+ *                     ('visits', '<u4'), ('move', '<u2'), ('depth', '<u2'),
+ *                     ('snapshot', '<u4')])
+ *   nodes = np.memmap('tree.bin', dtype=dtype, mode='r')
+ *
+ * While disabled, the search only pays for one branch per playout.
+ */
+
+typedef struct tree_record_t {
+    // Zobrist key of the node's position
+    uint64_t key;
+    // Total reward from the point of view of the player who made the move
+    double reward;
+    // Index of the parent's record in the file (the root points to itself)
+    uint32_t parent;
+    uint32_t visits;
+    // Move leading to the node (NULLMV for the root)
+    uint16_t move;
+    // Plies from the root
+    uint16_t depth;
+    // Snapshot the record belongs to (counted over all searches)
+    uint32_t snapshot;
+} tree_record_t;
+
+static_assert(sizeof(tree_record_t) == 32, "Tree records must not be padded");
+
+// Set while exporting
+extern bool treestats_enabled;
+
+// Time between two snapshots during a search (0 for one at the end only)
+extern uint64_t treestats_interval;
+
+/**
+ * @brief Starts exporting to the given file (truncating it)
+ * @param interval_ms time between two snapshots during a search
+ * @return false if the file couldn't be opened
+ */
+bool treestats_start(const std::string& path, int interval_ms);
+
+// Writes out the remaining records and closes the file
+void treestats_stop();
+
+/**
+ * @brief Appends a record to the current snapshot
+ * @return index of the record in the file
+ */
+uint32_t treestats_write(const tree_record_t& record);
+
+// Index the next record will get
+uint32_t treestats_next_index();
+
+// Ends the current snapshot, writing out its records
+void treestats_end_snapshot();
+
+// Number of the current snapshot
+uint32_t treestats_snapshot();
+
+#endif // TREESTATS_H_
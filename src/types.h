@@ -7,6 +7,9 @@
 #include <unordered_map>
 #include <atomic> // for search
 #include <iostream>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #define NAME "Lishex-MCTS"
 #define VERSION "v0.1.0"
@@ -17,6 +20,11 @@
 #define SQUARE_RANK_FOR(colour, sq) (((sq) >> 3) ^ ((colour) ? 0 : 0b0111))
 #define MAX_MOVES (256)
 #define MAX_DEPTH (128)
+// Default size of the search memory (MCTS tree) in MB
+#define DEFAULT_HASH_MB (2048)
+// Weight of implicit minimax values in MCTS selection (in percent, 0 turns
+// them off)
+#define DEFAULT_MINIMAX_WEIGHT (0)
 
 // Assertions for debug mode
 // #define DEBUG
@@ -281,53 +289,116 @@ typedef struct undo_t {
     piece_t captured = NO_PIECE;
 } undo_t;
 
-// Struct containing a move and its corresponding score for move ordering
-typedef struct scored_move_t {
-    int32_t score;
-    move_t move;
-
-    void operator=(move_t m) { move = m; }
-    bool operator==(const move_t& m) { return move == m; }
-    bool operator==(const scored_move_t& m) { return move == m.move; }
-    // Conversion operator, returning the move as a move_t
-    operator move_t() const { return move; }
-    inline int32_t get_score() const { return score; }
-} scored_move_t;
-
-// Move list structure
+/**
+ * @brief Move list structure
+ *
+ * Moves (16 bits suffice) and their scores for move ordering are kept in
+ * separate arrays, so that scanning for the best score or for a particular
+ * move only touches the data needed, 8 scores or 16 moves per AVX2 register.
+ * The arrays are padded so that the vector kernels may read (and move
+ * generation write) a full register past the end of the list; lanes beyond
+ * size() are ignored.
+ */
 typedef struct movelist_t {
-    const scored_move_t* begin() const { return movelist; }
-    const scored_move_t* end() const { return last; }
-    scored_move_t* begin() { return movelist; }
-    scored_move_t  operator[](int i) const { assert(i < size()); return movelist[i]; }
-    scored_move_t& operator[](int i) { return movelist[i]; }
-    size_t size() const { return static_cast<size_t>(last - movelist); }
+    const uint16_t* begin() const { return moves; }
+    const uint16_t* end() const { return moves + count; }
+    move_t operator[](int i) const { assert(i < size()); return moves[i]; }
+    size_t size() const { return count; }
     void push_back(const move_t& m) {
         assert(size() < MAX_MOVES);
-        *last++ = m;
+        moves[count++] = m;
     }
     void clear() {
         used = 0;
-        last = movelist;
+        count = 0;
     }
-    void erase(scored_move_t* position) {
-        assert(position >= movelist && position < last);
-        std::move(position + 1, last, position);
-        --last;
+    void swap(const size_t i, const size_t j) {
+        std::swap(moves[i], moves[j]);
+        std::swap(scores[i], scores[j]);
     }
-    scored_move_t* find(const move_t& target) {
-        for (scored_move_t* it = begin(); it != end(); ++it) {
-            if (*it == target) {
-                return it;
-            }
-        }
-        return nullptr;  // Not found
+    // Removes the i-th move in O(1) by moving the last one in its place
+    // (the order of the remaining moves is not kept)
+    void erase(const int i) {
+        assert(i >= 0 && static_cast<size_t>(i) < size());
+        --count;
+        moves[i] = moves[count];
+        scores[i] = scores[count];
     }
-    scored_move_t movelist[MAX_MOVES];
-    scored_move_t* last = movelist;
+    // Index of the target move, -1 if not in the list
+    int find(const move_t target) const;
+    // Index of the first move with the highest positive score in [from, size()),
+    // or from if there is none
+    size_t best(const size_t from) const;
+
+    alignas(32) uint16_t moves[MAX_MOVES + 32];
+    alignas(32) int32_t scores[MAX_MOVES + 8];
+    size_t count = 0;
     size_t used = 0;
 } movelist_t;
 
+#if defined(__AVX2__)
+inline int movelist_t::find(const move_t target) const {
+    const __m256i t = _mm256_set1_epi16(static_cast<int16_t>(target));
+    for (size_t i = 0; i < count; i += 16) {
+        const __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i*>(moves + i));
+        const uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(v, t));
+        if (mask) {
+            // Matches past the end come after all the valid lanes
+            const size_t idx = i + __builtin_ctz(mask) / 2;
+            return idx < count ? static_cast<int>(idx) : -1;
+        }
+    }
+    return -1;
+}
+
+inline size_t movelist_t::best(const size_t from) const {
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i n = _mm256_set1_epi32(static_cast<int32_t>(count));
+    // Maximum over the valid lanes (scores of 0 or less never win)
+    __m256i max = _mm256_setzero_si256();
+    for (size_t i = from; i < count; i += 8) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(scores + i));
+        const __m256i valid = _mm256_cmpgt_epi32(n, _mm256_add_epi32(lane, _mm256_set1_epi32(i)));
+        max = _mm256_max_epi32(max, _mm256_and_si256(v, valid));
+    }
+    max = _mm256_max_epi32(max, _mm256_permute2x128_si256(max, max, 1));
+    max = _mm256_max_epi32(max, _mm256_shuffle_epi32(max, _MM_SHUFFLE(1, 0, 3, 2)));
+    max = _mm256_max_epi32(max, _mm256_shuffle_epi32(max, _MM_SHUFFLE(2, 3, 0, 1)));
+    if (_mm256_cvtsi256_si32(max) <= 0) {
+        return from;
+    }
+    // The first lane holding it (it is among the valid ones, which come first)
+    for (size_t i = from; ; i += 8) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(scores + i));
+        const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, max)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+}
+#else
+inline int movelist_t::find(const move_t target) const {
+    for (size_t i = 0; i < count; ++i) {
+        if (moves[i] == target) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+inline size_t movelist_t::best(const size_t from) const {
+    size_t best_idx = from;
+    int32_t best_score = 0;
+    for (size_t i = from; i < count; ++i) {
+        if (scores[i] > best_score) {
+            best_score = scores[i];
+            best_idx = i;
+        }
+    }
+    return best_idx;
+}
+#endif
+
 inline std::string move_to_str(const move_t m) {
 
     if (m == NULLMV) return "null";
@@ -352,7 +423,8 @@ inline std::string move_to_str(const move_t m) {
     return s;
 }
 
-inline void print_moves(const movelist_t& ml) {
+template<typename List> // movelist_t or any other iterable list of moves
+inline void print_moves(const List& ml) {
     for (move_t move : ml) {
         std::cout << move_to_str(move) << ' ';
     }
@@ -419,10 +491,29 @@ typedef struct searchinfo_t {
     uint64_t hashcut = 0;
     uint64_t deltacut = 0;
     uint64_t seecut = 0;
+    uint64_t tbhits = 0;
+    // MCTS iterations (select, expand, simulate, backpropagate)
+    uint64_t playouts = 0;
     // For stopping the search
     bool quit = false;
     bool stopped = false;
     bool time_set = false;
+    // Search with MCTS instead of alpha-beta
+    bool use_mcts = false;
+    // Number of best moves to report (MultiPV)
+    int multipv = 1;
+    // Root moves to search ('go searchmoves'), all moves if empty
+    movelist_t searchmoves;
+    // Weight of implicit minimax values against playout averages (percent)
+    int minimax_weight = DEFAULT_MINIMAX_WEIGHT;
+    // Search at most this many nodes ('go nodes'), or MCTS playouts (0 for no
+    // limit)
+    uint64_t node_limit = 0;
+    // Pick the MCTS root move with Gumbel-top-k sampling and Sequential
+    // Halving instead of UCB
+    bool gumbel_root = false;
+    // Score MCTS leaves with the experimental lane playouts (see lanes.h)
+    bool lane_playouts = false;
     // Helper for clearing necessary struct info before searching
     inline void clear() {
         stopped = false;
@@ -433,6 +524,8 @@ typedef struct searchinfo_t {
         hashcut = 0ULL;
         deltacut = 0ULL;
         seecut = 0ULL;
+        tbhits = 0ULL;
+        playouts = 0ULL;
         seldepth = 0;
     }
 } searchinfo_t;
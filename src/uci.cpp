@@ -4,6 +4,8 @@
 #include <iomanip>
 #include <sstream>
 #include <fstream>
+#include <vector>
+#include <cctype>
 
 #include "board.h"
 #include "time.h"
@@ -12,20 +14,62 @@
 #include "order.h"
 #include "eval.h"
 #include "bench.h"
+#include "tablebase.h"
+#include "perf.h"
+#include "trace.h"
+#include "metrics.h"
+#include "mcts.h"
+#include "output.h"
+#include "treestats.h"
 
+namespace {
+
+/* Option handlers */
+
+bool on_hash(int megabytes) {
+    if (!resize_tree(megabytes)) {
+        std::cout << "info string Cannot allocate " << megabytes << " MB" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
 
 /* Options need to be non-static, since they influence
  * other parts of the engine (like search) */
 option_t options[] = {
-        {"Hash", OPT_TYPE::SPIN, 0, 128, 2047, -1},
+        {"Hash", OPT_TYPE::SPIN, 1, DEFAULT_HASH_MB, 1 << 20, DEFAULT_HASH_MB, &on_hash},
 //TODO: {"Ponder", OPT_TYPE::CHECK, 0, 0, 1, -1},
-        {"Move Safety Overhead", OPT_TYPE::SPIN, 0, 10, 50, -1},
-        {"Threads", OPT_TYPE::SPIN, 1, 1, 1, -1},
+        {"Move Safety Overhead", OPT_TYPE::SPIN, 0, 50, 5000, 50},
+        // The search is single-threaded for now (see threads.cpp)
+        {"Threads", OPT_TYPE::SPIN, 1, 1, 1, 1},
+        {"MultiPV", OPT_TYPE::SPIN, 1, 1, MAX_MOVES, 1},
+        // 'go' searches with MCTS instead of alpha-beta
+        {"Use MCTS", OPT_TYPE::CHECK, 0, 0, 1, 0},
+        {"Minimax Weight", OPT_TYPE::SPIN, 0, DEFAULT_MINIMAX_WEIGHT, 100, DEFAULT_MINIMAX_WEIGHT},
+        {"Gumbel Root", OPT_TYPE::CHECK, 0, 0, 1, 0},
+        {"Lane Playouts", OPT_TYPE::CHECK, 0, 0, 1, 0},
 //TODO: {"Use Book", OPT_TYPE::CHECK, 0, 0, 0, -1},
 //TODO: {"Book path", OPT_TYPE::STRING, 0, 0, 0, -1},
 };
 
 
+// Looks up an option by its (case-insensitive) name
+option_t *find_option(const std::string& name) {
+    auto same = [](const std::string& a, const std::string& b) {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                          [](char x, char y) { return std::tolower(x) == std::tolower(y); });
+    };
+    for (option_t& opt : options) {
+        if (same(opt.name, name)) {
+            return &opt;
+        }
+    }
+    return nullptr;
+}
+
+
 namespace {
 
 std::string opt_type_to_str[] = {
@@ -56,51 +100,106 @@ void print_options() {
     }
 }
 
-// TODO: onChangedHandler
-void set_option(std::string name, int value) {
-    std::cout << "Setting option " << name << " to " << value << std::endl;
-    for (auto opt : options) {
-        if (opt.name != name) continue;
+void set_option(const std::string& name, const std::string& value_str) {
+    option_t *opt = find_option(name);
+    if (opt == nullptr) {
+        std::cout << "info string Unknown option '" << name << "'" << std::endl;
+        return;
+    }
 
-        opt.value = value;
+    int value = 0;
+    switch (opt->type) {
+        case OPT_TYPE::CHECK:
+            value = value_str == "true"; break;
+        case OPT_TYPE::SPIN: {
+            std::istringstream iss(value_str);
+            if (!(iss >> value)) {
+                std::cout << "info string Invalid value '" << value_str << "' for "
+                          << opt->name << std::endl;
+                return;
+            }
+            value = std::clamp(value, opt->min, opt->max);
+            break;
+        }
+        case OPT_TYPE::BUTTON:
+            break;
+        case OPT_TYPE::COMBO:
+        case OPT_TYPE::STRING:
+            //TODO:
+            return;
     }
+
+    const int old_value = opt->value;
+    opt->value = value;
+    if (opt->on_change != nullptr && !opt->on_change(value)) {
+        opt->value = old_value;
+    }
+    std::cout << "info string " << opt->name << " set to " << opt->value << std::endl;
 }
 
+/**
+ * @brief The position last set up by parse_position(). A GUI resends the
+ * whole game with every move, so when the new move list merely extends this
+ * one (and the board hasn't been changed since), only the new moves are played.
+ */
+typedef struct last_position_t {
+    // "startpos" or the FEN
+    std::string base;
+    std::vector<std::string> moves;
+    // Board state after the moves were played
+    uint64_t key = 0ULL;
+    int history_ply = -1;
+} last_position_t;
+
+last_position_t last_position;
+
 // TODO: Pass the istringstream from the UCI loop by reference
 void parse_position(board_t *board, const std::string& pos_str) {
     size_t start_pos = pos_str.find("startpos");
     size_t fen_pos = pos_str.find("fen");
     size_t moves_pos = pos_str.find("moves");
 
-    if (start_pos != std::string::npos) {
-        setup(board, start_FEN);
-    } else if (fen_pos != std::string::npos) {
+    std::string base = "startpos";
+    if (start_pos == std::string::npos && fen_pos != std::string::npos) {
         size_t fen_start_pos = pos_str.find_first_not_of(" ", fen_pos + 3);
         size_t fen_end_pos = pos_str.find(" moves", fen_start_pos);
         if (moves_pos == std::string::npos) {
           fen_end_pos = pos_str.size();
         }
-        std::string fen_string = pos_str.substr(fen_start_pos, fen_end_pos - fen_start_pos);
-        setup(board, fen_string);
-    } else {
-        setup(board, start_FEN);
+        base = pos_str.substr(fen_start_pos, fen_end_pos - fen_start_pos);
     }
 
+    std::vector<std::string> moves;
     if (moves_pos != std::string::npos) {
-        size_t movesStartPos = pos_str.find_first_not_of(" ", moves_pos + 5);
-        if (movesStartPos == std::string::npos) return;
-        std::string movesString = pos_str.substr(movesStartPos);
-        std::istringstream iss(movesString);
+        std::istringstream iss(pos_str.substr(moves_pos + 5));
         std::string move_string;
-
         while (iss >> move_string) {
-            move_t move = str_to_move(board, move_string);
-            if (move != NULLMV) {
-                make_move(board, move);
-            }
-            board->ply = 0;
+            moves.push_back(move_string);
         }
     }
+
+    // Continue from the current board if it still holds the last position
+    // and the new moves extend its moves
+    const std::vector<std::string>& last_moves = last_position.moves;
+    size_t played = 0;
+    if (base == last_position.base && board->key == last_position.key
+        && board->history_ply == last_position.history_ply
+        && last_moves.size() <= moves.size()
+        && std::equal(last_moves.begin(), last_moves.end(), moves.begin())) {
+        played = last_moves.size();
+    } else {
+        setup(board, base == "startpos" ? start_FEN : base);
+    }
+
+    for (size_t i = played; i < moves.size(); ++i) {
+        move_t move = str_to_move(board, moves[i]);
+        if (move != NULLMV) {
+            make_move(board, move);
+        }
+    }
+    board->ply = 0;
+
+    last_position = { base, std::move(moves), board->key, board->history_ply };
 }
 
 void parse_go(board_t *board, searchinfo_t *info, std::istringstream &iss) {
@@ -109,6 +208,14 @@ void parse_go(board_t *board, searchinfo_t *info, std::istringstream &iss) {
     int time = -1, inc = 0;
     info->time_set = false;
     info->depth = -1;
+    info->use_mcts = find_option("Use MCTS")->value;
+    info->multipv = find_option("MultiPV")->value;
+    info->minimax_weight = find_option("Minimax Weight")->value;
+    info->gumbel_root = find_option("Gumbel Root")->value;
+    info->lane_playouts = find_option("Lane Playouts")->value;
+    info->node_limit = 0;
+    info->searchmoves.clear();
+    bool searchmoves = false;
 
     std::string token;
     while (iss >> token) {
@@ -138,10 +245,23 @@ void parse_go(board_t *board, searchinfo_t *info, std::istringstream &iss) {
         else if (token == "movetime") {
             iss >> movetime;
         }
+        else if (token == "nodes") {
+            iss >> info->node_limit;
+        }
         else if (token == "infinite") {
             // search until 'stop' sent from the GUI
             info->depth = MAX_DEPTH;
         }
+        else if (token == "searchmoves") {
+            // restrict the search to the moves that follow
+            searchmoves = true;
+        }
+        else if (searchmoves) {
+            move_t move = str_to_move(board, token);
+            if (move != NULLMV) {
+                info->searchmoves.push_back(move);
+            }
+        }
         else {
             std::cout << "Unrecognized or unsupported token '"
                       << token << "'" << std::endl;
@@ -163,7 +283,7 @@ void parse_go(board_t *board, searchinfo_t *info, std::istringstream &iss) {
         info->time /= movestogo;
 
         // to be safe we don't run out of time
-        info->time -= 50;
+        info->time -= find_option("Move Safety Overhead")->value;
         info->time = MAX(info->time, 0);
         info->end = info->start + info->time + inc;
     }
@@ -191,6 +311,7 @@ void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, std::thread &s
     } else if (token == "ucinewgame") {
         parse_position(board, "position startpos\n");
     } else if (token == "stop") {
+        trace_instant("stop received");
         search_stop(search_thread, info);
     } else if (token == "quit") {
         info->quit = true;
@@ -229,12 +350,16 @@ void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, std::thread &s
     } else if (token == "setoption") {
         // setoption name <id> [value <x>]
         std::string opt_name = "";
-        std::string tmp;
-        int opt_val = 0;
-        iss >> opt_name; // skips the "name" token
-        iss >> opt_name; // TODO: Options can have whitespaces in them
-        iss >> tmp; // skips the "value" token
+        std::string opt_val = "";
+        std::string word;
+        iss >> word; // skips the "name" token
+        // Names may contain spaces, up to the "value" token
+        while (iss >> word && word != "value") {
+            opt_name += (opt_name.empty() ? "" : " ") + word;
+        }
         iss >> opt_val;
+        // Options are only changed while not searching
+        search_stop(search_thread, info);
         set_option(opt_name, opt_val);
     } else if (token == "perft") {
         // Get user argument
@@ -258,7 +383,10 @@ void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, std::thread &s
         for (int depth = 1; depth <= depthSet; ++depth) {
             unsigned NPS = 0; // # Nodes per (mili)second
             uint64_t start = now();
+            perf_sample_t perf_start, perf_depth;
+            if (perf_enabled) perf_read(&perf_start);
             node_no = perft(board, depth);
+            perf_lap(&perf_start, &perf_depth);
             uint64_t elapsed = now() - start + 1; // handle div-by-zero
             // nodes per millisecond -> nodes per s
             NPS = node_no * 1000 / elapsed;
@@ -266,6 +394,9 @@ void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, std::thread &s
             std::cout << std::right << std::setw(12) << node_no << '\t';
             std::cout << std::right << std::setw(7) << elapsed << '\t';
             std::cout << std::right << std::setw(11) << NPS << std::endl;
+            if (perf_enabled) {
+                perf_print("depth " + std::to_string(depth), perf_depth);
+            }
             /*
             printf("Depth: %2d Nodes: %10lu Time: %5ld NPS: %7.0d\n",
                             depth,     node_no,     elapsed,  NPS);
@@ -319,7 +450,76 @@ void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, std::thread &s
         iss >> filename;
         process_file(filename, info, search_thread, board);
     } else if (token == "bench") {
-        bench(search_thread, board, info);
+        // bench [mcts|movelist|playouts]
+        std::string mode;
+        iss >> mode;
+        if (mode == "movelist") {
+            bench_movelist(board);
+        } else if (mode == "playouts") {
+            bench_playouts(board, info);
+        } else {
+            bench(search_thread, board, info, mode == "mcts");
+        }
+    } else if (token == "perf") {
+        // perf [on|off], toggles hardware performance counters
+        std::string mode;
+        iss >> mode;
+        perf_enabled = mode.empty() ? !perf_enabled : mode == "on";
+        std::cout << "info string perf counters " << (perf_enabled ? "on" : "off") << std::endl;
+    } else if (token == "trace") {
+        // trace [file], starts recording search events to be written on exit
+        // trace off, stops any search and writes the recorded events
+        std::string arg;
+        iss >> arg;
+        if (arg == "off") {
+            search_stop(search_thread, info);
+            if (trace_enabled) {
+                trace_enabled = false;
+                trace_dump();
+            }
+        } else {
+            trace_start(arg.empty() ? "lishex_trace.json" : arg);
+        }
+    } else if (token == "metrics") {
+        // metrics file|socket <path> [interval in ms], or metrics off
+        std::string kind, path;
+        int interval = 1000;
+        iss >> kind >> path >> interval;
+        if (kind == "off") {
+            metrics_stop();
+        } else if (!metrics_start(kind, path, interval)) {
+            std::cout << "info string Cannot export metrics to " << kind << " '" << path << "'" << std::endl;
+        }
+    } else if (token == "treestats") {
+        // treestats <file> [interval in ms], or treestats off
+        std::string path;
+        int interval = 0;
+        iss >> path >> interval;
+        search_stop(search_thread, info);
+        if (path == "off") {
+            treestats_stop();
+        } else if (!treestats_start(path, interval)) {
+            std::cout << "info string Cannot export the tree to '" << path << "'" << std::endl;
+        }
+    } else if (token == "selfplay") {
+        // selfplay [games] [playouts] [concurrent] [file]
+        int games = 100, playouts = 400, concurrent = 1;
+        std::string path = "selfplay.csv";
+        iss >> games >> playouts >> concurrent >> path;
+        // Self-play replaces the tree and the MAST table of the search
+        search_stop(search_thread, info);
+        MCTS_selfplay(info, games, playouts, concurrent, path);
+    } else if (token == "tbgen") {
+        // tbgen [directory] [threads]
+        std::string path = "tb";
+        int threads = std::thread::hardware_concurrency();
+        iss >> path >> threads;
+        tb_generate(path, threads);
+    } else if (token == "tbload") {
+        // tbload [directory]
+        std::string path = "tb";
+        iss >> path;
+        tb_init(path);
     } else {
         std::cout << "Unknown command: '" << token << "'" << std::endl;
     }
@@ -363,6 +563,7 @@ void loop(int argc, char* argv[]) {
     info->state = ENGINE_STOPPED;
 
     LOG("Starting the UCI loop...");
+    output_start();
 
     std::string input, token;
 
@@ -382,19 +583,49 @@ void loop(int argc, char* argv[]) {
     if (search_thread.joinable()) {
         search_thread.join();
     }
+    output_stop();
+    treestats_stop();
+
+    if (trace_enabled) {
+        trace_enabled = false;
+        trace_dump();
+    }
+    metrics_stop();
 
     LOG("Quitting the UCI loop...");
 }
 
 move_t str_to_move(board_t *board, const std::string& s) {
-    // TODO: Implement with a move generator to only convert to *legal* moves
-    movelist_t moves;
-    generate_moves(board, &moves);
-    for (const move_t move : moves) {
-        if (move_to_str(move) == s) {
-            return move;
+    // The flags follow from the position, is_pseudo_legal() checks the rest
+    auto square = [&](int i) { return (s[i + 1] - '1') * 8 + (s[i] - 'a'); };
+    if (s.size() < 4 || s.size() > 5 ||
+        s[0] < 'a' || s[0] > 'h' || s[1] < '1' || s[1] > '8' ||
+        s[2] < 'a' || s[2] > 'h' || s[3] < '1' || s[3] > '8') {
+        std::cout << "Move '" << s << "' is invalid!" << std::endl;
+        return NULLMV;
+    }
+    const square_t from = square(0), to = square(2);
+    const int type = piece_type(board->pieces[from]);
+    int flags = board->pieces[to] != NO_PIECE ? CAPTURE : QUIET;
+    if (type == PAWN && to == board->ep_square) {
+        flags = EPCAPTURE;
+    } else if (type == PAWN && std::abs(to - from) == 2 * NORTH) {
+        flags = PAWNPUSH;
+    } else if (type == KING && std::abs(to - from) == 2 * EAST) {
+        flags = to > from ? KINGCASTLE : QUEENCASTLE;
+    }
+    if (s.size() == 5) {
+        switch (s[4]) {
+            case 'n': flags |= KNIGHTPROMO; break;
+            case 'b': flags |= BISHOPPROMO; break;
+            case 'r': flags |= ROOKPROMO;   break;
+            case 'q': flags |= QUEENPROMO;  break;
         }
     }
-    std::cout << "Move '" << s << "' is invalid!" << std::endl;
-    return NULLMV;
+    const move_t move = Move(from, to, flags);
+    if (!is_pseudo_legal(board, move) || move_to_str(move) != s) {
+        std::cout << "Move '" << s << "' is invalid!" << std::endl;
+        return NULLMV;
+    }
+    return move;
 }
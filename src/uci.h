@@ -14,11 +14,17 @@ typedef struct option_t {
     OPT_TYPE type;
     int min, def, max;
     int value;
+    // Applies a new value to the engine, false if it couldn't be applied
+    // (the option then keeps its old value)
+    bool (*on_change)(int value) = nullptr;
 } option_t;
 
 // Global array storing UCI engine options
 extern option_t options[];
 
+// Looks up an option by its (case-insensitive) name, null if there's none
+option_t *find_option(const std::string& name);
+
 /**
  * @brief UCI driver loop
  *